@@ -0,0 +1,82 @@
+#include "audio_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace media {
+
+namespace {
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+}  // namespace
+
+AudioRing::AudioRing(size_t capacity)
+    : buffer_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 64))),
+      mask_(buffer_.size() - 1) {}
+
+size_t AudioRing::Write(const uint8_t* data, size_t size) {
+  size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+  size_t read_pos = read_pos_.load(std::memory_order_acquire);
+  size_t space = buffer_.size() - (write_pos - read_pos);
+  if (size > space) {
+    dropped_.fetch_add(size, std::memory_order_relaxed);
+    return 0;
+  }
+
+  // Copy in at most two pieces around the end of the buffer
+  size_t offset = write_pos & mask_;
+  size_t first = std::min(size, buffer_.size() - offset);
+  std::memcpy(buffer_.data() + offset, data, first);
+  std::memcpy(buffer_.data(), data + first, size - first);
+  write_pos_.store(write_pos + size, std::memory_order_release);
+
+  // Pairs with the waiter count increment so a reader about to sleep
+  // either sees the data or is seen here; the mutex closes the gap between
+  // its check and its wait
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (size > 0 && waiters_.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    data_ready_.notify_one();
+  }
+  return size;
+}
+
+size_t AudioRing::Available() const {
+  return write_pos_.load(std::memory_order_acquire) -
+         read_pos_.load(std::memory_order_relaxed);
+}
+
+size_t AudioRing::Read(uint8_t* data, size_t size) {
+  size_t read_pos = read_pos_.load(std::memory_order_relaxed);
+  size = std::min(size, write_pos_.load(std::memory_order_acquire) - read_pos);
+
+  size_t offset = read_pos & mask_;
+  size_t first = std::min(size, buffer_.size() - offset);
+  std::memcpy(data, buffer_.data() + offset, first);
+  std::memcpy(data + first, buffer_.data(), size - first);
+  read_pos_.store(read_pos + size, std::memory_order_release);
+  return size;
+}
+
+bool AudioRing::WaitForData(size_t size, std::chrono::steady_clock::time_point deadline) {
+  if (Available() >= size) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(wait_mutex_);
+  waiters_.fetch_add(1, std::memory_order_seq_cst);
+  bool ready = data_ready_.wait_until(lock, deadline, [this, size] {
+    return Available() >= size;
+  });
+  waiters_.fetch_sub(1, std::memory_order_relaxed);
+  return ready;
+}
+
+}  // namespace media
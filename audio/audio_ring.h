@@ -0,0 +1,69 @@
+#ifndef MEDIA_AUDIO_RING_H_
+#define MEDIA_AUDIO_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace media {
+
+// Lock-free single producer, single consumer byte ring for captured audio.
+// The producer (the PulseAudio thread) never blocks: a write that does not
+// fit is dropped whole and counted, so the ring only ever holds complete
+// fragments and never a partial sample frame. The consumer can wait for
+// data with a deadline; the producer only touches the wakeup mutex when a
+// reader is waiting.
+class AudioRing {
+ public:
+  // Capacity is rounded up to a power of two
+  explicit AudioRing(size_t capacity);
+
+  AudioRing(const AudioRing&) = delete;
+  AudioRing& operator=(const AudioRing&) = delete;
+
+  // Producer: appends all size bytes, or none if they do not fit. Returns
+  // how many were written.
+  size_t Write(const uint8_t* data, size_t size);
+
+  // Consumer: bytes ready to be read
+  size_t Available() const;
+
+  // Consumer: copies out up to size bytes, returns how many were read
+  size_t Read(uint8_t* data, size_t size);
+
+  // Consumer: waits until at least size bytes are ready or the deadline
+  // passes. Returns true if the data is there.
+  bool WaitForData(size_t size, std::chrono::steady_clock::time_point deadline);
+
+  // Total bytes ever written and read; the difference is what is buffered.
+  // Positions let callers tie side information (such as capture times) to
+  // bytes in the ring.
+  size_t GetWritePosition() const { return write_pos_.load(std::memory_order_acquire); }
+  size_t GetReadPosition() const { return read_pos_.load(std::memory_order_relaxed); }
+
+  // Bytes dropped because the consumer fell behind
+  uint64_t GetDroppedBytes() const { return dropped_.load(std::memory_order_relaxed); }
+
+  size_t GetCapacity() const { return buffer_.size(); }
+
+ private:
+  std::vector<uint8_t> buffer_;
+  size_t mask_;
+
+  // Monotonic positions; each side only writes its own
+  std::atomic<size_t> write_pos_{0};
+  std::atomic<size_t> read_pos_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  std::mutex wait_mutex_;
+  std::condition_variable data_ready_;
+  std::atomic<int> waiters_{0};
+};
+
+}  // namespace media
+
+#endif  // MEDIA_AUDIO_RING_H_
@@ -1,8 +1,10 @@
 #include "pulse_audio_device.h"
 
+#include <algorithm>
 #include <iostream>
 #include <chrono>
-#include <thread>
+#include "capture_clock.h"
+#include "sample_convert.h"
 
 namespace media {
 
@@ -10,22 +12,57 @@ namespace {
 // Wait timeout in milliseconds
 constexpr int kPulseOperationTimeoutMs = 5000;
 
-// Helper function to wait for an operation to complete
-[[maybe_unused]] void WaitForOperation(pa_operation* op, pa_mainloop* mainloop) {
+// Captured audio the ring holds before the oldest data is dropped
+constexpr int kRingBufferMs = 500;
+
+// Holds the threaded mainloop lock for a scope
+class MainloopLock {
+public:
+    explicit MainloopLock(pa_threaded_mainloop* mainloop) : mainloop_(mainloop) {
+        pa_threaded_mainloop_lock(mainloop_);
+    }
+    ~MainloopLock() { pa_threaded_mainloop_unlock(mainloop_); }
+
+    MainloopLock(const MainloopLock&) = delete;
+    MainloopLock& operator=(const MainloopLock&) = delete;
+
+private:
+    pa_threaded_mainloop* mainloop_;
+};
+
+// Helper function to wait for an operation to complete, with the mainloop
+// lock held and callbacks signalling the mainloop. Gives up and cancels the
+// operation after kPulseOperationTimeoutMs.
+void WaitForOperation(pa_operation* op, pa_threaded_mainloop* mainloop) {
     if (!op) return;
     
-    auto start_time = std::chrono::steady_clock::now();
-    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
-        pa_mainloop_iterate(mainloop, 1, nullptr);
-        
-        auto current_time = std::chrono::steady_clock::now();
-        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            current_time - start_time).count();
-        
-        if (elapsed_ms > kPulseOperationTimeoutMs) {
-            std::cerr << "PulseAudio operation timed out." << std::endl;
-            break;
-        }
+    // pa_threaded_mainloop_wait has no timeout; a timer event on the
+    // mainloop wakes us instead
+    struct Deadline {
+        pa_threaded_mainloop* mainloop;
+        bool passed;
+    } deadline = {mainloop, false};
+    pa_mainloop_api* api = pa_threaded_mainloop_get_api(mainloop);
+    timeval when;
+    pa_timeval_add(pa_gettimeofday(&when),
+                   static_cast<pa_usec_t>(kPulseOperationTimeoutMs) * PA_USEC_PER_MSEC);
+    pa_time_event* timer = api->time_new(
+        api, &when,
+        [](pa_mainloop_api*, pa_time_event*, const timeval*, void* userdata) {
+            Deadline* deadline = static_cast<Deadline*>(userdata);
+            deadline->passed = true;
+            pa_threaded_mainloop_signal(deadline->mainloop, 0);
+        },
+        &deadline);
+    
+    while (pa_operation_get_state(op) == PA_OPERATION_RUNNING && !deadline.passed) {
+        pa_threaded_mainloop_wait(mainloop);
+    }
+    api->time_free(timer);
+    
+    if (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
+        std::cerr << "PulseAudio operation timed out." << std::endl;
+        pa_operation_cancel(op);
     }
     pa_operation_unref(op);
 }
@@ -44,6 +81,11 @@ PulseAudioDevice::PulseAudioDevice(const PulseAudioDeviceConfig& config)
     : config_(config) {}
 
 PulseAudioDevice::~PulseAudioDevice() {
+    // Stop the mainloop thread first so no callback runs during teardown
+    if (mainloop_) {
+        pa_threaded_mainloop_stop(mainloop_);
+    }
+    
     if (stream_) {
         pa_stream_disconnect(stream_);
         pa_stream_unref(stream_);
@@ -55,19 +97,19 @@ PulseAudioDevice::~PulseAudioDevice() {
     }
     
     if (mainloop_) {
-        pa_mainloop_free(mainloop_);
+        pa_threaded_mainloop_free(mainloop_);
     }
 }
 
 bool PulseAudioDevice::Initialize() {
-    // Create a mainloop API and connection to the default server
-    mainloop_ = pa_mainloop_new();
+    // Create a threaded mainloop, which runs callbacks on its own thread
+    mainloop_ = pa_threaded_mainloop_new();
     if (!mainloop_) {
         std::cerr << "Failed to create PulseAudio mainloop." << std::endl;
         return false;
     }
     
-    mainloop_api_ = pa_mainloop_get_api(mainloop_);
+    mainloop_api_ = pa_threaded_mainloop_get_api(mainloop_);
     
     context_ = pa_context_new(mainloop_api_, "PulseAudioDevice");
     if (!context_) {
@@ -75,12 +117,22 @@ bool PulseAudioDevice::Initialize() {
         return false;
     }
     
-    // Connect to the PulseAudio server
-    pa_context_connect(context_, nullptr, PA_CONTEXT_NOFLAGS, nullptr);
-    
-    // Set the state callback
+    // Set the state callback, which wakes the waits below
     pa_context_set_state_callback(context_, ContextStateCallback, this);
     
+    // Everything from here on runs against the live mainloop thread
+    MainloopLock lock(mainloop_);
+    if (pa_threaded_mainloop_start(mainloop_) < 0) {
+        std::cerr << "Failed to start PulseAudio mainloop." << std::endl;
+        return false;
+    }
+    
+    // Connect to the PulseAudio server
+    if (pa_context_connect(context_, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+        std::cerr << "Failed to connect to PulseAudio server." << std::endl;
+        return false;
+    }
+    
     // Wait for the context to be ready
     while (true) {
         pa_context_state_t state = pa_context_get_state(context_);
@@ -93,14 +145,53 @@ bool PulseAudioDevice::Initialize() {
             return false;
         }
         
-        pa_mainloop_iterate(mainloop_, 1, nullptr);
+        pa_threaded_mainloop_wait(mainloop_);
     }
     
+    // Capture at the source's own rate when converting in-process
+    stream_rate_ = config_.sample_rate;
+    if (config_.resample) {
+        int source_rate = QuerySourceRate();
+        if (source_rate <= 0) {
+            std::cerr << "Could not query source rate, letting the server resample." << std::endl;
+        } else if (source_rate != config_.sample_rate) {
+            resampler_ = Resampler::Create(source_rate, config_.sample_rate,
+                                           config_.channels, config_.resample_quality);
+            if (!resampler_) {
+                return false;
+            }
+            stream_rate_ = source_rate;
+        }
+    }
+    read_float_ = config_.float_samples || resampler_;
+    
     // Set up the sample specification
     pa_sample_spec sample_spec;
-    sample_spec.format = PA_SAMPLE_S16LE;
-    sample_spec.rate = config_.sample_rate;
+    sample_spec.format = config_.float_samples ? PA_SAMPLE_FLOAT32LE : PA_SAMPLE_S16LE;
+    sample_spec.rate = stream_rate_;
     sample_spec.channels = config_.channels;
+    frame_bytes_ = static_cast<size_t>(config_.channels) * (config_.float_samples ? 4 : 2);
+    
+    // Packets are whole sample frames, rounded to the nearest one. When
+    // resampling, packets are cut from the resampler's output instead.
+    size_t stream_packet_bytes = 0;
+    if (config_.packet_ms > 0) {
+        size_t packet_frames = static_cast<size_t>(
+            config_.sample_rate * config_.packet_ms / 1000.0 + 0.5);
+        size_t stream_packet_frames = static_cast<size_t>(
+            stream_rate_ * config_.packet_ms / 1000.0 + 0.5);
+        stream_packet_bytes = std::max<size_t>(stream_packet_frames, 1) * frame_bytes_;
+        if (resampler_) {
+            packet_frames_ = std::max<size_t>(packet_frames, 1);
+        } else {
+            packet_bytes_ = stream_packet_bytes;
+        }
+    }
+    
+    // Size the ring before the stream can deliver anything
+    size_t ring_bytes = static_cast<size_t>(stream_rate_) * frame_bytes_ *
+        std::max(kRingBufferMs, 2 * config_.buffer_ms) / 1000;
+    ring_.reset(new AudioRing(std::max(ring_bytes, 4 * stream_packet_bytes)));
     
     // Create the recording stream
     stream_ = pa_stream_new(context_, "record", &sample_spec, nullptr);
@@ -115,17 +206,31 @@ bool PulseAudioDevice::Initialize() {
     // Set the stream read callback
     pa_stream_set_read_callback(stream_, StreamReadCallback, this);
     
-    // Calculate buffer attributes based on config
+    // Calculate buffer attributes based on config. The fragment size is
+    // what sets capture latency: the server hands data over a fragment at a
+    // time, while maxlength only bounds how much it holds if we stall.
     pa_buffer_attr buffer_attr;
-    buffer_attr.maxlength = (config_.sample_rate * config_.channels * 2 * config_.buffer_ms) / 1000;
-    buffer_attr.fragsize = buffer_attr.maxlength;
+    buffer_attr.maxlength = static_cast<uint32_t>(
+        pa_usec_to_bytes(static_cast<pa_usec_t>(config_.buffer_ms) * 1000, &sample_spec));
+    if (config_.fragment_ms > 0) {
+        buffer_attr.fragsize = static_cast<uint32_t>(
+            pa_usec_to_bytes(static_cast<pa_usec_t>(config_.fragment_ms) * 1000, &sample_spec));
+        buffer_attr.fragsize = std::min(buffer_attr.fragsize, buffer_attr.maxlength);
+    } else {
+        buffer_attr.fragsize = buffer_attr.maxlength;
+        if (stream_packet_bytes > 0 && stream_packet_bytes < buffer_attr.fragsize) {
+            // Have the server deliver at packet pace rather than per buffer
+            buffer_attr.fragsize = static_cast<uint32_t>(stream_packet_bytes);
+        }
+    }
     buffer_attr.prebuf = (uint32_t)-1;
     buffer_attr.minreq = (uint32_t)-1;
     buffer_attr.tlength = (uint32_t)-1;
     
     // Connect the stream for recording
     pa_stream_flags_t flags = 
-        static_cast<pa_stream_flags_t>(PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE);
+        static_cast<pa_stream_flags_t>(PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE |
+                                       PA_STREAM_INTERPOLATE_TIMING);
     
     // If device_id is empty, use monitor of default output device
     const char* source_name = nullptr;  // Default source
@@ -150,46 +255,214 @@ bool PulseAudioDevice::Initialize() {
             return false;
         }
         
-        pa_mainloop_iterate(mainloop_, 1, nullptr);
+        pa_threaded_mainloop_wait(mainloop_);
+    }
+    
+    // The server may round or clamp what we asked for; report what we got
+    const pa_buffer_attr* granted = pa_stream_get_buffer_attr(stream_);
+    if (granted) {
+        auto bytes_to_ms = [&](uint32_t bytes) {
+            size_t bytes_per_second = static_cast<size_t>(stream_rate_) * frame_bytes_;
+            return static_cast<int>((static_cast<size_t>(bytes) * 1000 + bytes_per_second / 2) /
+                                    bytes_per_second);
+        };
+        config_.buffer_ms = bytes_to_ms(granted->maxlength);
+        config_.fragment_ms = std::max(bytes_to_ms(granted->fragsize), 1);
+    }
+    
+    return true;
+}
+
+bool PulseAudioDevice::GetFrameS16LE(std::vector<uint8_t>* audio_data, int64_t* timestamp_us) {
+    if (!audio_data) {
+        return false;
+    }
+    if (!read_float_) {
+        return ReadSamples(audio_data, timestamp_us);
     }
     
-    // Pre-allocate buffer based on expected size
-    size_t expected_bytes = (config_.sample_rate * config_.channels * 2 * config_.buffer_ms) / 1000;
-    buffer_.reserve(expected_bytes);
+    if (!ReadSamples(&convert_buffer_, timestamp_us)) {
+        return false;
+    }
+    size_t samples = convert_buffer_.size() / sizeof(float);
+    audio_data->resize(samples * sizeof(int16_t));
+    ConvertF32ToS16(reinterpret_cast<const float*>(convert_buffer_.data()),
+                    reinterpret_cast<int16_t*>(audio_data->data()), samples);
+    return true;
+}
+
+bool PulseAudioDevice::GetFrameF32LE(std::vector<uint8_t>* audio_data, int64_t* timestamp_us) {
+    if (!audio_data) {
+        return false;
+    }
+    if (read_float_) {
+        return ReadSamples(audio_data, timestamp_us);
+    }
     
+    if (!ReadSamples(&convert_buffer_, timestamp_us)) {
+        return false;
+    }
+    size_t samples = convert_buffer_.size() / sizeof(int16_t);
+    audio_data->resize(samples * sizeof(float));
+    ConvertS16ToF32(reinterpret_cast<const int16_t*>(convert_buffer_.data()),
+                    reinterpret_cast<float*>(audio_data->data()), samples);
     return true;
 }
 
-bool PulseAudioDevice::GetFrameS16LE(std::vector<uint8_t>* audio_data) {
-    if (!audio_data || !stream_ || !mainloop_) {
+bool PulseAudioDevice::GetFrameS32LE(std::vector<uint8_t>* audio_data, int64_t* timestamp_us) {
+    if (!audio_data || !ReadSamples(&convert_buffer_, timestamp_us)) {
         return false;
     }
     
-    buffer_.clear();
-    buffer_ready_ = false;
+    size_t samples = convert_buffer_.size() / (read_float_ ? sizeof(float) : sizeof(int16_t));
+    audio_data->resize(samples * sizeof(int32_t));
+    int32_t* dst = reinterpret_cast<int32_t*>(audio_data->data());
+    if (read_float_) {
+        ConvertF32ToS32(reinterpret_cast<const float*>(convert_buffer_.data()), dst, samples);
+    } else {
+        ConvertS16ToS32(reinterpret_cast<const int16_t*>(convert_buffer_.data()), dst, samples);
+    }
+    return true;
+}
+
+int PulseAudioDevice::QuerySourceRate() {
+    struct Query {
+        pa_threaded_mainloop* mainloop;
+        int rate;
+    } query = {mainloop_, 0};
     
-    // Process events until we get data or timeout
-    auto start_time = std::chrono::steady_clock::now();
-    while (!buffer_ready_) {
-        pa_mainloop_iterate(mainloop_, 0, nullptr);
+    // The server's default source unless a device was named
+    const char* source_name = "@DEFAULT_SOURCE@";
+    if (!config_.device_id.empty()) {
+        source_name = config_.device_id.c_str();
+    }
+    
+    pa_operation* op = pa_context_get_source_info_by_name(
+        context_, source_name,
+        [](pa_context*, const pa_source_info* info, int eol, void* userdata) {
+            Query* query = static_cast<Query*>(userdata);
+            if (info && eol == 0) {
+                query->rate = static_cast<int>(info->sample_spec.rate);
+            }
+            pa_threaded_mainloop_signal(query->mainloop, 0);
+        },
+        &query);
+    WaitForOperation(op, mainloop_);
+    return query.rate;
+}
+
+bool PulseAudioDevice::ReadSamples(std::vector<uint8_t>* audio_data, int64_t* timestamp_us) {
+    if (resampler_) {
+        return ReadResampled(audio_data, timestamp_us);
+    }
+    return ReadStream(audio_data, timestamp_us);
+}
+
+bool PulseAudioDevice::ReadResampled(std::vector<uint8_t>* audio_data, int64_t* timestamp_us) {
+    size_t channels = static_cast<size_t>(config_.channels);
+    size_t wanted = packet_frames_ > 0 ? packet_frames_ : 1;
+    while (resampled_.size() / channels < wanted) {
+        uint64_t stream_frame = ring_->GetReadPosition() / frame_bytes_;
         
-        auto current_time = std::chrono::steady_clock::now();
-        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-            current_time - start_time).count();
+        // Output frames map onto stream frames only while the stream is
+        // continuous. Once the ring has dropped data, start over from the
+        // read position, so audio from either side of the gap is neither
+        // filtered together nor timed as if nothing were missing.
+        uint64_t dropped_bytes = ring_->GetDroppedBytes();
+        if (dropped_bytes != seen_dropped_bytes_) {
+            seen_dropped_bytes_ = dropped_bytes;
+            resampler_->Reset();
+            resampled_.clear();
+            output_frames_ = stream_frame * config_.sample_rate / stream_rate_;
+        }
         
-        if (elapsed_ms > kPulseOperationTimeoutMs) {
-            std::cerr << "Timeout waiting for audio data." << std::endl;
+        int64_t stream_time_us = 0;
+        if (!ReadStream(&stream_buffer_, &stream_time_us)) {
             return false;
         }
+        input_anchor_frame_ = stream_frame;
+        input_anchor_us_ = stream_time_us;
         
-        // Short sleep to avoid busy-waiting
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        size_t frames = stream_buffer_.size() / frame_bytes_;
+        const float* input = reinterpret_cast<const float*>(stream_buffer_.data());
+        if (!config_.float_samples) {
+            resample_input_.resize(frames * channels);
+            ConvertS16ToF32(reinterpret_cast<const int16_t*>(stream_buffer_.data()),
+                            resample_input_.data(), frames * channels);
+            input = resample_input_.data();
+        }
+        resampler_->Process(input, frames, &resampled_);
     }
     
-    *audio_data = buffer_;
+    size_t count = packet_frames_ > 0 ? packet_frames_ : resampled_.size() / channels;
+    if (timestamp_us) {
+        // Output frame n is centered on stream frame n * stream / output rate
+        double stream_frame = static_cast<double>(output_frames_) * stream_rate_ / config_.sample_rate;
+        *timestamp_us = input_anchor_us_ + static_cast<int64_t>(
+            (stream_frame - static_cast<double>(input_anchor_frame_)) * 1000000.0 / stream_rate_);
+    }
+    
+    size_t samples = count * channels;
+    audio_data->resize(samples * sizeof(float));
+    std::copy(resampled_.begin(), resampled_.begin() + samples,
+              reinterpret_cast<float*>(audio_data->data()));
+    resampled_.erase(resampled_.begin(), resampled_.begin() + samples);
+    output_frames_ += count;
     return true;
 }
 
+bool PulseAudioDevice::ReadStream(std::vector<uint8_t>* audio_data, int64_t* timestamp_us) {
+    if (!stream_ || !ring_) {
+        return false;
+    }
+    
+    // Sleep until the mainloop thread has delivered a packet, or at least
+    // one frame when reading everything
+    size_t wanted = packet_bytes_ > 0 ? packet_bytes_ : frame_bytes_;
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(config_.read_timeout_ms);
+    if (!ring_->WaitForData(wanted, deadline)) {
+        if (config_.read_timeout_ms > 0) {
+            std::cerr << "Timeout waiting for audio data." << std::endl;
+        }
+        return false;
+    }
+    
+    // Hand out whole frames only
+    size_t count = packet_bytes_;
+    if (count == 0) {
+        count = ring_->Available();
+        count -= count % frame_bytes_;
+    }
+    if (timestamp_us) {
+        *timestamp_us = TimestampAt(ring_->GetReadPosition());
+    }
+    audio_data->resize(count);
+    ring_->Read(audio_data->data(), count);
+    return true;
+}
+
+int64_t PulseAudioDevice::TimestampAt(size_t position) {
+    time_anchors_.Update();
+    const TimeAnchor& anchor = time_anchors_.front();
+    if (anchor.time_us == 0) {
+        // Data raced ahead of the first anchor; it was captured just now
+        return GetCaptureClockUs();
+    }
+    
+    // Work back from the newest captured byte at the stream's byte rate,
+    // without crossing the gap a dropped fragment left
+    size_t anchor_position = anchor.position;
+    int64_t anchor_time_us = anchor.time_us;
+    if (position < anchor.gap_position) {
+        anchor_position = anchor.gap_position;
+        anchor_time_us = anchor.gap_time_us;
+    }
+    int64_t bytes_after = static_cast<int64_t>(anchor_position - position);
+    int64_t bytes_per_second = static_cast<int64_t>(stream_rate_) * frame_bytes_;
+    return anchor_time_us - bytes_after * 1000000 / bytes_per_second;
+}
+
 void PulseAudioDevice::StreamReadCallback(
     pa_stream* stream, [[maybe_unused]] size_t nbytes, void* userdata) {
     PulseAudioDevice* device = static_cast<PulseAudioDevice*>(userdata);
@@ -202,18 +475,44 @@ void PulseAudioDevice::StreamReadCallback(
         return;
     }
     
+    // A null pointer with a size is a hole in the stream; skip it
+    bool written = false;
     if (bytes > 0 && data != nullptr) {
-        // Copy data to our buffer
-        const uint8_t* byte_data = static_cast<const uint8_t*>(data);
-        device->buffer_.insert(device->buffer_.end(), byte_data, byte_data + bytes);
-        device->buffer_ready_ = true;
+        // Never blocks; if the reader has fallen behind the whole fragment
+        // is dropped, and what was written before it is timed on its own
+        written = device->ring_->Write(static_cast<const uint8_t*>(data), bytes) == bytes;
+        if (!written) {
+            device->newest_anchor_.gap_position = device->newest_anchor_.position;
+            device->newest_anchor_.gap_time_us = device->newest_anchor_.time_us;
+        }
     }
     
     // Mark data as read
-    pa_stream_drop(stream);
+    if (bytes > 0) {
+        pa_stream_drop(stream);
+    }
+    
+    if (written) {
+        // The stream's latency is how long ago the next unread sample, the
+        // one after this fragment, was captured at the source
+        int64_t now = GetCaptureClockUs();
+        pa_usec_t latency = 0;
+        int negative = 0;
+        if (pa_stream_get_latency(stream, &latency, &negative) == 0) {
+            now += negative ? static_cast<int64_t>(latency) : -static_cast<int64_t>(latency);
+        }
+        
+        device->newest_anchor_.position = device->ring_->GetWritePosition();
+        device->newest_anchor_.time_us = now;
+        device->time_anchors_.back() = device->newest_anchor_;
+        device->time_anchors_.Publish();
+    }
 }
 
-void PulseAudioDevice::StreamStateCallback(pa_stream* stream, [[maybe_unused]] void* userdata) {
+void PulseAudioDevice::StreamStateCallback(pa_stream* stream, void* userdata) {
+    PulseAudioDevice* device = static_cast<PulseAudioDevice*>(userdata);
+    pa_threaded_mainloop_signal(device->mainloop_, 0);
+    
     switch (pa_stream_get_state(stream)) {
         case PA_STREAM_READY:
             std::cout << "PulseAudio stream ready." << std::endl;
@@ -230,7 +529,10 @@ void PulseAudioDevice::StreamStateCallback(pa_stream* stream, [[maybe_unused]] v
     }
 }
 
-void PulseAudioDevice::ContextStateCallback(pa_context* context, [[maybe_unused]] void* userdata) {
+void PulseAudioDevice::ContextStateCallback(pa_context* context, void* userdata) {
+    PulseAudioDevice* device = static_cast<PulseAudioDevice*>(userdata);
+    pa_threaded_mainloop_signal(device->mainloop_, 0);
+    
     switch (pa_context_get_state(context)) {
         case PA_CONTEXT_READY:
             std::cout << "PulseAudio context ready." << std::endl;
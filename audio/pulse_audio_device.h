@@ -5,14 +5,26 @@
 #include <string>
 #include <vector>
 #include <pulse/pulseaudio.h>
+#include "audio_ring.h"
+#include "resampler.h"
+#include "triple_buffer.h"
 
 namespace media {
 
 struct PulseAudioDeviceConfig {
     int sample_rate;
     int channels;
-    int buffer_ms;
+    int buffer_ms;          // Most audio the server buffers for us (maxlength)
+    int fragment_ms = 0;    // Audio per server delivery (fragsize), 0 for buffer_ms
     std::string device_id;  // Empty string means default device
+    int read_timeout_ms = 5000;  // Longest GetFrameS16LE waits for data, 0 to not wait
+    double packet_ms = 0.0;  // If set, every read returns exactly this much audio
+    bool float_samples = false;  // Open the stream in F32LE instead of S16LE
+
+    // Open the stream at the source's native rate and convert to
+    // sample_rate here rather than in the server
+    bool resample = false;
+    ResampleQuality resample_quality = ResampleQuality::MEDIUM;
 };
 
 class PulseAudioDevice {
@@ -23,11 +35,22 @@ public:
     // Destructor to clean up PulseAudio resources
     ~PulseAudioDevice();
 
-    // Gets a frame of audio data in signed 16-bit little-endian format
-    // Returns true on success, false on failure
-    bool GetFrameS16LE(std::vector<uint8_t>* audio_data);
-
-    // Returns current configuration
+    // Gets all audio captured since the last call in signed 16-bit
+    // little-endian format, waiting up to read_timeout_ms if there is none.
+    // With packet_ms set, waits for and returns exactly one packet instead.
+    // timestamp_us, if given, receives the time the first sample was
+    // captured at the source, corrected for stream latency, in
+    // GetCaptureClockUs microseconds.
+    // Returns true on success, false on failure or timeout
+    bool GetFrameS16LE(std::vector<uint8_t>* audio_data, int64_t* timestamp_us = nullptr);
+
+    // Same as GetFrameS16LE, in 32-bit float or signed 32-bit little-endian
+    // format. Float reads are copied straight out when float_samples is set.
+    bool GetFrameF32LE(std::vector<uint8_t>* audio_data, int64_t* timestamp_us = nullptr);
+    bool GetFrameS32LE(std::vector<uint8_t>* audio_data, int64_t* timestamp_us = nullptr);
+
+    // Returns current configuration, with buffer_ms and fragment_ms set to
+    // what the server actually granted
     const PulseAudioDeviceConfig& GetConfig() const { return config_; }
 
 private:
@@ -37,6 +60,19 @@ private:
     // Initializes PulseAudio connection and stream
     bool Initialize();
 
+    // Returns the native rate of the source being captured, 0 if unknown
+    int QuerySourceRate();
+
+    // Reads captured samples at sample_rate, in float when resampling and
+    // in the stream's own format otherwise
+    bool ReadSamples(std::vector<uint8_t>* data, int64_t* timestamp_us);
+
+    // Reads captured samples exactly as the stream delivered them
+    bool ReadStream(std::vector<uint8_t>* data, int64_t* timestamp_us);
+
+    // Reads from the stream and resamples until there is output to return
+    bool ReadResampled(std::vector<uint8_t>* data, int64_t* timestamp_us);
+
     // Callback for when new audio data is available
     static void StreamReadCallback(pa_stream* stream, size_t nbytes, void* userdata);
 
@@ -49,15 +85,47 @@ private:
     // Configuration parameters
     PulseAudioDeviceConfig config_;
 
-    // PulseAudio objects
-    pa_mainloop* mainloop_ = nullptr;
+    // PulseAudio objects, driven by the threaded mainloop's own thread
+    pa_threaded_mainloop* mainloop_ = nullptr;
     pa_mainloop_api* mainloop_api_ = nullptr;
     pa_context* context_ = nullptr;
     pa_stream* stream_ = nullptr;
 
-    // Buffer for collecting audio data
-    std::vector<uint8_t> buffer_;
-    bool buffer_ready_ = false;
+    // Captured samples, written by StreamReadCallback on the mainloop
+    // thread and read by GetFrameS16LE
+    std::unique_ptr<AudioRing> ring_;
+    size_t frame_bytes_ = 0;   // Bytes per sample frame, all channels
+    size_t packet_bytes_ = 0;  // Fixed read size, 0 to read everything
+    int stream_rate_ = 0;      // Rate of the stream and ring, sample_rate unless resampling
+    bool read_float_ = false;  // Whether ReadSamples returns float
+    std::vector<uint8_t> convert_buffer_;  // ReadSamples output awaiting conversion
+
+    // In-process rate conversion, null when the stream runs at sample_rate
+    std::unique_ptr<Resampler> resampler_;
+    std::vector<uint8_t> stream_buffer_;  // Stream samples awaiting resampling
+    std::vector<float> resample_input_;   // Same, converted to float
+    std::vector<float> resampled_;        // Output not yet returned
+    size_t packet_frames_ = 0;            // Output frames per read, 0 for all
+    uint64_t output_frames_ = 0;          // Output frames returned so far
+    uint64_t input_anchor_frame_ = 0;     // Stream frame last read...
+    int64_t input_anchor_us_ = 0;         // ...and its capture time
+    uint64_t seen_dropped_bytes_ = 0;     // Ring drops already started over after
+
+    // Capture time of the newest byte in the ring, published by the
+    // mainloop thread so reads can be stamped without locking. A dropped
+    // fragment leaves a gap in capture time, so the newest byte written
+    // before the latest drop is kept too; bytes up to it are timed from it.
+    struct TimeAnchor {
+        size_t position = 0;  // Ring write position
+        int64_t time_us = 0;
+        size_t gap_position = 0;
+        int64_t gap_time_us = 0;
+    };
+    TripleBuffer<TimeAnchor> time_anchors_;
+    TimeAnchor newest_anchor_;  // Mainloop thread only, last one published
+    
+    // Returns the capture time of the byte at a ring position
+    int64_t TimestampAt(size_t position);
 };
 
 }  // namespace media
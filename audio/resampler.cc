@@ -0,0 +1,241 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "cpu_features.h"
+
+#ifdef MEDIA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace media {
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Longest filter used when downsampling widens it
+constexpr size_t kMaxTaps = 512;
+
+struct QualityPreset {
+  size_t taps;
+  double rolloff;      // Passband edge as a fraction of the lower Nyquist
+  double kaiser_beta;  // Window shape, higher trades width for rejection
+};
+
+QualityPreset GetPreset(ResampleQuality quality) {
+  switch (quality) {
+    case ResampleQuality::FAST:
+      return {16, 0.90, 6.0};
+    case ResampleQuality::HIGH:
+      return {64, 0.97, 10.0};
+    case ResampleQuality::MEDIUM:
+    default:
+      return {32, 0.94, 8.0};
+  }
+}
+
+uint32_t Gcd(uint32_t a, uint32_t b) {
+  while (b != 0) {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Zeroth order modified Bessel function of the first kind
+double BesselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50 && term > sum * 1e-12; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+//
+// Dot product kernels. Lengths are always a multiple of 8.
+//
+
+float Dot_C(const float* a, const float* b, size_t n) {
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+#ifdef MEDIA_X86_KERNELS
+
+__attribute__((target("sse2")))
+float Dot_SSE2(const float* a, const float* b, size_t n) {
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  for (size_t i = 0; i < n; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  __m128 sum = _mm_add_ps(sum0, sum1);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2")))
+float Dot_AVX2(const float* a, const float* b, size_t n) {
+  __m256 sum = _mm256_setzero_ps();
+  for (size_t i = 0; i < n; i += 8) {
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+  return _mm_cvtss_f32(half);
+}
+
+#endif  // MEDIA_X86_KERNELS
+
+typedef float (*DotFunc)(const float*, const float*, size_t);
+
+DotFunc SelectDot(CpuLevel level) {
+#ifdef MEDIA_X86_KERNELS
+  if (level >= CpuLevel::AVX2) {
+    return Dot_AVX2;
+  }
+  if (level >= CpuLevel::SSE2) {
+    return Dot_SSE2;
+  }
+#else
+  (void)level;
+#endif
+  return Dot_C;
+}
+
+DotFunc GetDot() {
+  static const DotFunc dot = SelectDot(GetCpuLevel());
+  return dot;
+}
+
+}  // namespace
+
+std::unique_ptr<Resampler> Resampler::Create(int input_rate, int output_rate,
+                                             int channels, ResampleQuality quality) {
+  if (input_rate <= 0 || output_rate <= 0 || channels <= 0) {
+    std::cerr << "Invalid resampler format: " << input_rate << " Hz to "
+              << output_rate << " Hz, " << channels << " channels" << std::endl;
+    return nullptr;
+  }
+  return std::unique_ptr<Resampler>(
+      new Resampler(input_rate, output_rate, channels, quality));
+}
+
+Resampler::Resampler(int input_rate, int output_rate, int channels,
+                     ResampleQuality quality)
+    : input_rate_(input_rate), output_rate_(output_rate), channels_(channels) {
+  uint32_t gcd = Gcd(input_rate, output_rate);
+  upsample_ = output_rate / gcd;
+  step_ = input_rate / gcd;
+  phases_ = std::min<uint32_t>(upsample_, kMaxPhases);
+
+  // Downsampling lowers the cutoff below the input Nyquist, which needs a
+  // proportionally longer filter for the same transition band
+  QualityPreset preset = GetPreset(quality);
+  double ratio = std::min(1.0, static_cast<double>(output_rate) / input_rate);
+  double cutoff = ratio * preset.rolloff;
+  taps_ = static_cast<size_t>(std::ceil(preset.taps / ratio));
+  taps_ = std::min(kMaxTaps, (taps_ + 7) & ~static_cast<size_t>(7));
+
+  // Phase p interpolates at p / phases_ of the way to the next frame, from
+  // the taps_ frames centered on that point
+  filters_.resize(taps_ * phases_);
+  double half = taps_ / 2.0;
+  double window_norm = BesselI0(preset.kaiser_beta);
+  for (uint32_t p = 0; p < phases_; ++p) {
+    double frac = static_cast<double>(p) / phases_;
+    float* filter = &filters_[p * taps_];
+    double sum = 0.0;
+    for (size_t j = 0; j < taps_; ++j) {
+      double distance = static_cast<double>(j) - (half - 1.0) - frac;
+      double x = cutoff * distance;
+      double sinc = x == 0.0 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+      double w = distance / half;
+      double window = std::abs(w) >= 1.0
+          ? 0.0
+          : BesselI0(preset.kaiser_beta * std::sqrt(1.0 - w * w)) / window_norm;
+      filter[j] = static_cast<float>(sinc * window);
+      sum += filter[j];
+    }
+
+    // Unity gain at DC for every phase
+    for (size_t j = 0; j < taps_; ++j) {
+      filter[j] = static_cast<float>(filter[j] / sum);
+    }
+  }
+
+  history_.resize(channels_);
+  Reset();
+}
+
+void Resampler::Reset() {
+  // Prime with silence so the first output lines up with the first input
+  for (std::vector<float>& channel : history_) {
+    channel.assign(taps_ / 2 - 1, 0.0f);
+  }
+  position_ = taps_ / 2 - 1;
+  phase_ = 0;
+}
+
+void Resampler::Process(const float* input, size_t frames, std::vector<float>* output) {
+  for (int c = 0; c < channels_; ++c) {
+    std::vector<float>& channel = history_[c];
+    size_t start = channel.size();
+    channel.resize(start + frames);
+    for (size_t i = 0; i < frames; ++i) {
+      channel[start + i] = input[i * channels_ + c];
+    }
+  }
+
+  size_t available = history_[0].size();
+  output->reserve(output->size() +
+                  (frames * upsample_ / step_ + 1) * static_cast<size_t>(channels_));
+  DotFunc dot = GetDot();
+
+  // An output needs taps_ / 2 frames after its center, plus one more in case
+  // a rounded phase moves it to the next frame
+  while (position_ + taps_ / 2 + 1 < available) {
+    size_t center = position_;
+    uint32_t phase = phase_;
+    if (phases_ != upsample_) {
+      phase = static_cast<uint32_t>(
+          (static_cast<uint64_t>(phase_) * phases_ + upsample_ / 2) / upsample_);
+      if (phase == phases_) {
+        phase = 0;
+        ++center;
+      }
+    }
+
+    const float* filter = &filters_[phase * taps_];
+    size_t first = center + 1 - taps_ / 2;
+    for (int c = 0; c < channels_; ++c) {
+      output->push_back(dot(&history_[c][first], filter, taps_));
+    }
+
+    uint64_t next = static_cast<uint64_t>(phase_) + step_;
+    position_ += static_cast<size_t>(next / upsample_);
+    phase_ = static_cast<uint32_t>(next % upsample_);
+  }
+
+  // Keep only the frames future outputs still reach back to
+  size_t drop = std::min(position_ + 1 - taps_ / 2, available);
+  if (drop > 0) {
+    for (std::vector<float>& channel : history_) {
+      channel.erase(channel.begin(), channel.begin() + drop);
+    }
+    position_ -= drop;
+  }
+}
+
+}  // namespace media
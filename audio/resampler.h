@@ -0,0 +1,63 @@
+#ifndef MEDIA_RESAMPLER_H_
+#define MEDIA_RESAMPLER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "media_device.h"
+
+namespace media {
+
+// Polyphase windowed-sinc resampler for interleaved float audio. The rate
+// ratio is reduced to L/M and one filter phase is precomputed per output
+// position, so common ratios such as 44.1 <-> 48 kHz (160/147) run from an
+// exact table. Ratios needing more than kMaxPhases phases use the nearest
+// of kMaxPhases evenly spaced phases. Not thread safe.
+class Resampler {
+ public:
+  static constexpr int kMaxPhases = 1024;
+
+  // Returns null if a rate or the channel count is not positive
+  static std::unique_ptr<Resampler> Create(int input_rate, int output_rate,
+                                           int channels, ResampleQuality quality);
+
+  Resampler(const Resampler&) = delete;
+  Resampler& operator=(const Resampler&) = delete;
+
+  // Resamples frames of input and appends whatever output is complete.
+  // Input is kept until the filter has seen enough of what follows it.
+  void Process(const float* input, size_t frames, std::vector<float>* output);
+
+  // Drops buffered input, as if newly created
+  void Reset();
+
+  int GetInputRate() const { return input_rate_; }
+  int GetOutputRate() const { return output_rate_; }
+
+ private:
+  Resampler(int input_rate, int output_rate, int channels, ResampleQuality quality);
+
+  int input_rate_;
+  int output_rate_;
+  int channels_;
+
+  // Output advances the input by step_ / upsample_ frames
+  uint32_t upsample_;  // L
+  uint32_t step_;      // M
+
+  // Coefficients, taps_ per phase, phases_ phases back to back
+  size_t taps_;
+  uint32_t phases_;
+  std::vector<float> filters_;
+
+  // Planar input history per channel, so each output is one contiguous
+  // dot product per channel
+  std::vector<std::vector<float>> history_;
+  size_t position_ = 0;  // History frame the next output is centered on
+  uint32_t phase_ = 0;   // Fractional position in 1/upsample_ frames
+};
+
+}  // namespace media
+
+#endif  // MEDIA_RESAMPLER_H_
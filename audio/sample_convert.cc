@@ -0,0 +1,237 @@
+#include "sample_convert.h"
+
+#include <algorithm>
+#include "cpu_features.h"
+
+#ifdef MEDIA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace media {
+
+namespace {
+
+// Largest float below 2^31; scaling 1.0 by 2^31 would overflow int32
+constexpr float kMaxS32Float = 2147483520.0f;
+
+//
+// Scalar kernels, also used for the tails of the vector kernels. NaN input
+// clamps to full scale, which is what the vector min/max produce as well.
+//
+
+void F32ToS16_C(const float* src, int16_t* dst, size_t samples) {
+  for (size_t i = 0; i < samples; ++i) {
+    float sample = std::max(-1.0f, std::min(1.0f, src[i]));
+    dst[i] = static_cast<int16_t>(sample * 32767.0f);
+  }
+}
+
+void F32ToS32_C(const float* src, int32_t* dst, size_t samples) {
+  for (size_t i = 0; i < samples; ++i) {
+    float sample = std::max(-1.0f, std::min(1.0f, src[i]));
+    dst[i] = static_cast<int32_t>(std::min(sample * 2147483648.0f, kMaxS32Float));
+  }
+}
+
+void S16ToF32_C(const int16_t* src, float* dst, size_t samples) {
+  for (size_t i = 0; i < samples; ++i) {
+    dst[i] = src[i] * (1.0f / 32768.0f);
+  }
+}
+
+void S16ToS32_C(const int16_t* src, int32_t* dst, size_t samples) {
+  for (size_t i = 0; i < samples; ++i) {
+    dst[i] = static_cast<int32_t>(static_cast<uint32_t>(static_cast<uint16_t>(src[i])) << 16);
+  }
+}
+
+#ifdef MEDIA_X86_KERNELS
+
+__attribute__((target("sse2")))
+void F32ToS16_SSE2(const float* src, int16_t* dst, size_t samples) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 minus_one = _mm_set1_ps(-1.0f);
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128 a = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i), one), minus_one);
+    __m128 b = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i + 4), one), minus_one);
+    __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(_mm_mul_ps(a, scale)),
+                                     _mm_cvttps_epi32(_mm_mul_ps(b, scale)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+  }
+  F32ToS16_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+void F32ToS32_SSE2(const float* src, int32_t* dst, size_t samples) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 minus_one = _mm_set1_ps(-1.0f);
+  const __m128 scale = _mm_set1_ps(2147483648.0f);
+  const __m128 max_value = _mm_set1_ps(kMaxS32Float);
+  size_t i = 0;
+  for (; i + 4 <= samples; i += 4) {
+    __m128 a = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(src + i), one), minus_one);
+    a = _mm_min_ps(_mm_mul_ps(a, scale), max_value);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_cvttps_epi32(a));
+  }
+  F32ToS32_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+void S16ToF32_SSE2(const int16_t* src, float* dst, size_t samples) {
+  const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    // Sign extend by placing each sample in the top half and shifting down
+    __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(value, value), 16);
+    __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(value, value), 16);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+  }
+  S16ToF32_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+void S16ToS32_SSE2(const int16_t* src, int32_t* dst, size_t samples) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(zero, value));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(zero, value));
+  }
+  S16ToS32_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+void F32ToS16_AVX2(const float* src, int16_t* dst, size_t samples) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 minus_one = _mm256_set1_ps(-1.0f);
+  const __m256 scale = _mm256_set1_ps(32767.0f);
+  size_t i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m256 a = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(src + i), one), minus_one);
+    __m256 b = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(src + i + 8), one), minus_one);
+    // Packing works per 128-bit lane, put the halves back in order
+    __m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(a, scale)),
+                                        _mm256_cvttps_epi32(_mm256_mul_ps(b, scale)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  F32ToS16_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+void F32ToS32_AVX2(const float* src, int32_t* dst, size_t samples) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 minus_one = _mm256_set1_ps(-1.0f);
+  const __m256 scale = _mm256_set1_ps(2147483648.0f);
+  const __m256 max_value = _mm256_set1_ps(kMaxS32Float);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256 a = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(src + i), one), minus_one);
+    a = _mm256_min_ps(_mm256_mul_ps(a, scale), max_value);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_cvttps_epi32(a));
+  }
+  F32ToS32_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+void S16ToF32_AVX2(const int16_t* src, float* dst, size_t samples) {
+  const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256i value = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(value), scale));
+  }
+  S16ToF32_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+void S16ToS32_AVX2(const int16_t* src, int32_t* dst, size_t samples) {
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m256i value = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_slli_epi32(value, 16));
+  }
+  S16ToS32_C(src + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void F32ToS16_AVX512(const float* src, int16_t* dst, size_t samples) {
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512 minus_one = _mm512_set1_ps(-1.0f);
+  const __m512 scale = _mm512_set1_ps(32767.0f);
+  size_t i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m512 a = _mm512_max_ps(_mm512_min_ps(_mm512_loadu_ps(src + i), one), minus_one);
+    __m512i value = _mm512_cvttps_epi32(_mm512_mul_ps(a, scale));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm512_cvtsepi32_epi16(value));
+  }
+  F32ToS16_C(src + i, dst + i, samples - i);
+}
+
+#endif  // MEDIA_X86_KERNELS
+
+typedef void (*F32ToS16Func)(const float*, int16_t*, size_t);
+typedef void (*F32ToS32Func)(const float*, int32_t*, size_t);
+typedef void (*S16ToF32Func)(const int16_t*, float*, size_t);
+typedef void (*S16ToS32Func)(const int16_t*, int32_t*, size_t);
+
+struct SampleKernels {
+  F32ToS16Func f32_to_s16;
+  F32ToS32Func f32_to_s32;
+  S16ToF32Func s16_to_f32;
+  S16ToS32Func s16_to_s32;
+};
+
+SampleKernels SelectKernels(CpuLevel level) {
+  SampleKernels kernels = {F32ToS16_C, F32ToS32_C, S16ToF32_C, S16ToS32_C};
+#ifdef MEDIA_X86_KERNELS
+  if (level >= CpuLevel::SSE2) {
+    kernels.f32_to_s16 = F32ToS16_SSE2;
+    kernels.f32_to_s32 = F32ToS32_SSE2;
+    kernels.s16_to_f32 = S16ToF32_SSE2;
+    kernels.s16_to_s32 = S16ToS32_SSE2;
+  }
+  if (level >= CpuLevel::AVX2) {
+    kernels.f32_to_s16 = F32ToS16_AVX2;
+    kernels.f32_to_s32 = F32ToS32_AVX2;
+    kernels.s16_to_f32 = S16ToF32_AVX2;
+    kernels.s16_to_s32 = S16ToS32_AVX2;
+  }
+  if (level >= CpuLevel::AVX512) {
+    kernels.f32_to_s16 = F32ToS16_AVX512;
+  }
+#endif
+  return kernels;
+}
+
+const SampleKernels& GetKernels() {
+  static const SampleKernels kernels = SelectKernels(GetCpuLevel());
+  return kernels;
+}
+
+}  // namespace
+
+void ConvertF32ToS16(const float* src, int16_t* dst, size_t samples) {
+  GetKernels().f32_to_s16(src, dst, samples);
+}
+
+void ConvertF32ToS32(const float* src, int32_t* dst, size_t samples) {
+  GetKernels().f32_to_s32(src, dst, samples);
+}
+
+void ConvertS16ToF32(const int16_t* src, float* dst, size_t samples) {
+  GetKernels().s16_to_f32(src, dst, samples);
+}
+
+void ConvertS16ToS32(const int16_t* src, int32_t* dst, size_t samples) {
+  GetKernels().s16_to_s32(src, dst, samples);
+}
+
+}  // namespace media
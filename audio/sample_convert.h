@@ -0,0 +1,25 @@
+#ifndef MEDIA_SAMPLE_CONVERT_H_
+#define MEDIA_SAMPLE_CONVERT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace media {
+
+// Converts float samples to signed 16-bit. Input is clamped to [-1.0, 1.0]
+// and scaled by 32767, truncating toward zero.
+void ConvertF32ToS16(const float* src, int16_t* dst, size_t samples);
+
+// Converts float samples to signed 32-bit. Input is clamped to [-1.0, 1.0]
+// and scaled by 2^31, saturating at the top of the range.
+void ConvertF32ToS32(const float* src, int32_t* dst, size_t samples);
+
+// Converts signed 16-bit samples to float in [-1.0, 1.0), dividing by 2^15
+void ConvertS16ToF32(const int16_t* src, float* dst, size_t samples);
+
+// Widens signed 16-bit samples to signed 32-bit, exactly
+void ConvertS16ToS32(const int16_t* src, int32_t* dst, size_t samples);
+
+}  // namespace media
+
+#endif  // MEDIA_SAMPLE_CONVERT_H_
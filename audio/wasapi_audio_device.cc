@@ -5,6 +5,8 @@
 #include <mmreg.h>
 #include <algorithm>
 #include <cstring>
+#include "capture_clock.h"
+#include "sample_convert.h"
 
 namespace media {
 
@@ -209,6 +211,7 @@ bool WASAPIAudioDevice::CaptureAudioFrame() {
   BYTE* data;
   DWORD flags;
   UINT64 position;
+  UINT64 qpc_position;
   HRESULT hr;
   
   raw_buffer_.clear();
@@ -226,11 +229,19 @@ bool WASAPIAudioDevice::CaptureAudioFrame() {
     }
     
     // Get the packet
-    hr = capture_client_->GetBuffer(&data, &packet_length, &flags, &position, nullptr);
+    hr = capture_client_->GetBuffer(&data, &packet_length, &flags, &position, &qpc_position);
     if (FAILED(hr)) {
       return false;
     }
     
+    // The frame is stamped with when its first packet was recorded; the
+    // position is in 100 ns performance counter units
+    if (raw_buffer_.empty()) {
+      last_timestamp_us_ = (flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)
+          ? GetCaptureClockUs()
+          : static_cast<int64_t>(qpc_position / 10);
+    }
+    
     // Skip silent packets
     if (!(flags & AUDCLNT_BUFFERFLAGS_SILENT)) {
       // Append data to buffer
@@ -279,14 +290,8 @@ bool WASAPIAudioDevice::GetFrameS16LE(std::vector<uint8_t>* audio_data) {
     audio_data->resize(frames * channels_ * sizeof(int16_t));
     int16_t* dst = reinterpret_cast<int16_t*>(audio_data->data());
     
-    // Convert each sample
-    for (size_t i = 0; i < frames * channels_; ++i) {
-      float sample = src[i];
-      // Clamp to [-1.0, 1.0]
-      sample = std::max(-1.0f, std::min(1.0f, sample));
-      // Convert to INT16 range
-      dst[i] = static_cast<int16_t>(sample * 32767.0f);
-    }
+    // Clamp to [-1.0, 1.0] and convert to INT16 range
+    ConvertF32ToS16(src, dst, frames * channels_);
     
     return true;
   }
@@ -295,4 +300,62 @@ bool WASAPIAudioDevice::GetFrameS16LE(std::vector<uint8_t>* audio_data) {
   return false;
 }
 
+bool WASAPIAudioDevice::GetFrameF32LE(std::vector<uint8_t>* audio_data) {
+  if (!audio_data) {
+    return false;
+  }
+  
+  // Capture raw audio
+  if (!CaptureAudioFrame()) {
+    return false;
+  }
+  
+  // Shared mode mix format is normally float already
+  if (bits_per_sample_ == 32) {
+    *audio_data = raw_buffer_;
+    return true;
+  }
+  
+  if (bits_per_sample_ == 16) {
+    size_t samples = raw_buffer_.size() / sizeof(int16_t);
+    audio_data->resize(samples * sizeof(float));
+    ConvertS16ToF32(reinterpret_cast<const int16_t*>(raw_buffer_.data()),
+                    reinterpret_cast<float*>(audio_data->data()), samples);
+    return true;
+  }
+  
+  // Unsupported format
+  return false;
+}
+
+bool WASAPIAudioDevice::GetFrameS32LE(std::vector<uint8_t>* audio_data) {
+  if (!audio_data) {
+    return false;
+  }
+  
+  // Capture raw audio
+  if (!CaptureAudioFrame()) {
+    return false;
+  }
+  
+  if (bits_per_sample_ == 32) {
+    size_t samples = raw_buffer_.size() / sizeof(float);
+    audio_data->resize(samples * sizeof(int32_t));
+    ConvertF32ToS32(reinterpret_cast<const float*>(raw_buffer_.data()),
+                    reinterpret_cast<int32_t*>(audio_data->data()), samples);
+    return true;
+  }
+  
+  if (bits_per_sample_ == 16) {
+    size_t samples = raw_buffer_.size() / sizeof(int16_t);
+    audio_data->resize(samples * sizeof(int32_t));
+    ConvertS16ToS32(reinterpret_cast<const int16_t*>(raw_buffer_.data()),
+                    reinterpret_cast<int32_t*>(audio_data->data()), samples);
+    return true;
+  }
+  
+  // Unsupported format
+  return false;
+}
+
 }  // namespace media
\ No newline at end of file
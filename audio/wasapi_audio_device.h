@@ -34,6 +34,14 @@ class WASAPIAudioDevice {
   // Get audio frame as signed 16-bit PCM
   bool GetFrameS16LE(std::vector<uint8_t>* audio_data);
 
+  // Get audio frame as 32-bit float or signed 32-bit PCM
+  bool GetFrameF32LE(std::vector<uint8_t>* audio_data);
+  bool GetFrameS32LE(std::vector<uint8_t>* audio_data);
+
+  // Capture time of the first sample of the last frame, from the device's
+  // performance counter position, in GetCaptureClockUs microseconds
+  int64_t GetLastTimestampUs() const { return last_timestamp_us_; }
+
  private:
   // Constructor
   explicit WASAPIAudioDevice(const WASAPIAudioDeviceConfig& config);
@@ -65,6 +73,7 @@ class WASAPIAudioDevice {
   
   // Raw audio buffer
   std::vector<uint8_t> raw_buffer_;
+  int64_t last_timestamp_us_ = 0;
   
   // COM initialization flag
   bool com_initialized_;
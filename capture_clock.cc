@@ -0,0 +1,30 @@
+#include "capture_clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace media {
+
+int64_t GetCaptureClockUs() {
+#ifdef _WIN32
+  // Same time base as the QPC positions WASAPI reports for captured audio
+  static const int64_t frequency = [] {
+    LARGE_INTEGER value;
+    QueryPerformanceFrequency(&value);
+    return value.QuadPart;
+  }();
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return counter.QuadPart / frequency * 1000000 +
+         counter.QuadPart % frequency * 1000000 / frequency;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+}  // namespace media
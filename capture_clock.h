@@ -0,0 +1,15 @@
+#ifndef MEDIA_CAPTURE_CLOCK_H_
+#define MEDIA_CAPTURE_CLOCK_H_
+
+#include <cstdint>
+
+namespace media {
+
+// Returns the current time in microseconds on the clock every capture
+// timestamp is expressed in: CLOCK_MONOTONIC on Linux and the performance
+// counter on Windows. Only differences between values are meaningful.
+int64_t GetCaptureClockUs();
+
+}  // namespace media
+
+#endif  // MEDIA_CAPTURE_CLOCK_H_
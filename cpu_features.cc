@@ -0,0 +1,105 @@
+#include "cpu_features.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace media {
+
+namespace {
+
+// Environment variable overriding the detected level
+constexpr const char* kCpuLevelEnv = "MEDIADEVICE_CPU_LEVEL";
+
+const CpuLevel kAllLevels[] = {
+  CpuLevel::SCALAR,
+  CpuLevel::SSE2,
+  CpuLevel::SSSE3,
+  CpuLevel::SSE41,
+  CpuLevel::AVX2,
+  CpuLevel::AVX512,
+};
+
+CpuLevel DetectCpuLevel() {
+#ifdef MEDIA_X86_KERNELS
+  // These also check that the OS saves the wider register state
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return CpuLevel::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return CpuLevel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return CpuLevel::SSE41;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return CpuLevel::SSSE3;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return CpuLevel::SSE2;
+  }
+#endif
+  return CpuLevel::SCALAR;
+}
+
+bool ParseCpuLevel(const char* name, CpuLevel* level) {
+  for (CpuLevel candidate : kAllLevels) {
+    if (std::strcmp(name, CpuLevelName(candidate)) == 0) {
+      *level = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+CpuLevel SelectCpuLevel() {
+  CpuLevel detected = DetectCpuLevel();
+  
+  const char* forced_name = std::getenv(kCpuLevelEnv);
+  if (!forced_name || forced_name[0] == '\0') {
+    return detected;
+  }
+  
+  CpuLevel forced;
+  if (!ParseCpuLevel(forced_name, &forced)) {
+    std::cerr << "Unknown " << kCpuLevelEnv << " '" << forced_name
+              << "', using " << CpuLevelName(detected) << std::endl;
+    return detected;
+  }
+  
+  // Never select kernels the CPU cannot run
+  if (forced > detected) {
+    std::cerr << kCpuLevelEnv << " '" << forced_name << "' is not supported"
+              << " by this CPU, using " << CpuLevelName(detected) << std::endl;
+    return detected;
+  }
+  return forced;
+}
+
+}  // namespace
+
+CpuLevel GetCpuLevel() {
+  static const CpuLevel level = SelectCpuLevel();
+  return level;
+}
+
+const char* CpuLevelName(CpuLevel level) {
+  switch (level) {
+    case CpuLevel::SCALAR:
+      return "scalar";
+    case CpuLevel::SSE2:
+      return "sse2";
+    case CpuLevel::SSSE3:
+      return "ssse3";
+    case CpuLevel::SSE41:
+      return "sse4.1";
+    case CpuLevel::AVX2:
+      return "avx2";
+    case CpuLevel::AVX512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+}  // namespace media
@@ -0,0 +1,33 @@
+#ifndef MEDIA_CPU_FEATURES_H_
+#define MEDIA_CPU_FEATURES_H_
+
+// x86 kernels are compiled per function with GCC/Clang target attributes
+// and picked at runtime, so the library itself is built without -m flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MEDIA_X86_KERNELS 1
+#endif
+
+namespace media {
+
+// Instruction set levels, ordered from least to most capable
+enum class CpuLevel {
+  SCALAR,
+  SSE2,
+  SSSE3,
+  SSE41,
+  AVX2,
+  AVX512,  // AVX-512 F and BW
+};
+
+// Returns the level pixel and sample kernels should use. This is the best
+// level the CPU supports, unless MEDIADEVICE_CPU_LEVEL is set to one of
+// "scalar", "sse2", "ssse3", "sse4.1", "avx2" or "avx512" to force a lower
+// one for benchmarking. Detected once per process.
+CpuLevel GetCpuLevel();
+
+// Returns the name used by MEDIADEVICE_CPU_LEVEL for a level
+const char* CpuLevelName(CpuLevel level);
+
+}  // namespace media
+
+#endif  // MEDIA_CPU_FEATURES_H_
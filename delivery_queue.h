@@ -0,0 +1,123 @@
+#ifndef MEDIA_DELIVERY_QUEUE_H_
+#define MEDIA_DELIVERY_QUEUE_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "media_device.h"
+
+namespace media {
+
+// Passes what a dropped item carried on to the item delivered in its
+// place. A frame's dirty tiles and missed frames are relative to the
+// previous frame, so the next one takes them over and counts the dropped
+// frame as missed. Audio packets carry nothing forward.
+inline void FoldDropped(const Frame& dropped, Frame* next) {
+  next->dirty_tiles.Merge(dropped.dirty_tiles);
+  next->missed_frames += dropped.missed_frames + 1;
+}
+
+inline void FoldDropped(const AudioPacket&, AudioPacket*) {}
+
+// Bounded queue drained by its own thread into a sink callback. Items are
+// swapped in and out of preallocated slots, so buffers inside them (such
+// as vectors) keep their capacity and are recycled back to the producer.
+template <typename T>
+class DeliveryQueue {
+ public:
+  DeliveryQueue(std::function<void(const T&)> sink, Backpressure backpressure,
+                int depth)
+      : sink_(std::move(sink)),
+        backpressure_(backpressure),
+        slots_(backpressure == Backpressure::COALESCE || depth < 1 ? 1 : depth) {
+    thread_ = std::thread(&DeliveryQueue::DeliveryLoop, this);
+  }
+
+  ~DeliveryQueue() { Stop(); }
+
+  DeliveryQueue(const DeliveryQueue&) = delete;
+  DeliveryQueue& operator=(const DeliveryQueue&) = delete;
+
+  // Stops delivery, discarding queued items, and releases a blocked Push
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    not_empty_.notify_all();
+    not_full_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Queues *item by swapping it into a slot; *item receives a recycled
+  // value. Applies the backpressure policy when the queue is full. Returns
+  // false if an undelivered item was dropped or the queue is stopping.
+  bool Push(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool dropped = false;
+    if (count_ == slots_.size()) {
+      if (backpressure_ == Backpressure::BLOCK) {
+        not_full_.wait(lock, [this] { return stopping_ || count_ < slots_.size(); });
+        if (stopping_) {
+          return false;
+        }
+      } else {
+        // Drop the oldest; with a single slot this coalesces to the newest
+        T& next = count_ > 1 ? slots_[(head_ + 1) % slots_.size()] : *item;
+        FoldDropped(slots_[head_], &next);
+        head_ = (head_ + 1) % slots_.size();
+        --count_;
+        dropped = true;
+      }
+    }
+    std::swap(slots_[(head_ + count_) % slots_.size()], *item);
+    ++count_;
+    lock.unlock();
+    not_empty_.notify_one();
+    return !dropped;
+  }
+
+ private:
+  void DeliveryLoop() {
+    T item;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return stopping_ || count_ > 0; });
+        if (stopping_) {
+          return;
+        }
+        std::swap(item, slots_[head_]);
+        head_ = (head_ + 1) % slots_.size();
+        --count_;
+      }
+      not_full_.notify_one();
+
+      // Run the sink without the lock so capture is never held up by it,
+      // except under BLOCK once the queue is full
+      sink_(item);
+    }
+  }
+
+  std::function<void(const T&)> sink_;
+  Backpressure backpressure_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::vector<T> slots_;
+  size_t head_ = 0;
+  size_t count_ = 0;
+  bool stopping_ = false;
+
+  std::thread thread_;
+};
+
+}  // namespace media
+
+#endif  // MEDIA_DELIVERY_QUEUE_H_
@@ -0,0 +1,81 @@
+#include "dirty_tile_map.h"
+
+#include <algorithm>
+
+namespace media {
+
+void DirtyTileMap::Reset(int width, int height, int tile_size) {
+  tile_size_ = std::max(tile_size, 1);
+  columns_ = width > 0 ? (width + tile_size_ - 1) / tile_size_ : 0;
+  rows_ = height > 0 ? (height + tile_size_ - 1) / tile_size_ : 0;
+  bits_.assign((static_cast<size_t>(columns_) * rows_ + 7) / 8, 0);
+}
+
+void DirtyTileMap::MarkAll() {
+  size_t tiles = static_cast<size_t>(columns_) * rows_;
+  std::fill(bits_.begin(), bits_.end(), 0xff);
+  if (tiles % 8 != 0) {
+    bits_.back() = static_cast<uint8_t>((1u << (tiles % 8)) - 1);
+  }
+}
+
+void DirtyTileMap::MarkRect(int x, int y, int width, int height) {
+  if (width <= 0 || height <= 0 || columns_ == 0 || rows_ == 0) {
+    return;
+  }
+  int first_column = std::max(x, 0) / tile_size_;
+  int first_row = std::max(y, 0) / tile_size_;
+  int last_column = std::min((x + width - 1) / tile_size_, columns_ - 1);
+  int last_row = std::min((y + height - 1) / tile_size_, rows_ - 1);
+  for (int row = first_row; row <= last_row; ++row) {
+    for (int column = first_column; column <= last_column; ++column) {
+      size_t index = static_cast<size_t>(row) * columns_ + column;
+      bits_[index / 8] |= static_cast<uint8_t>(1u << (index % 8));
+    }
+  }
+}
+
+void DirtyTileMap::MarkBlocks(const uint8_t* blocks, int block_columns,
+                              int block_rows, int block_size) {
+  for (int row = 0; row < block_rows; ++row) {
+    const uint8_t* line = blocks + static_cast<size_t>(row) * block_columns;
+    for (int column = 0; column < block_columns; ++column) {
+      if (!line[column]) {
+        continue;
+      }
+      // Merge runs of changed blocks into one rectangle
+      int run = 1;
+      while (column + run < block_columns && line[column + run]) {
+        ++run;
+      }
+      MarkRect(column * block_size, row * block_size, run * block_size, block_size);
+      column += run - 1;
+    }
+  }
+}
+
+void DirtyTileMap::Merge(const DirtyTileMap& other) {
+  if (tile_size_ == 0) {
+    return;
+  }
+  if (other.tile_size_ != tile_size_ || other.columns_ != columns_ ||
+      other.rows_ != rows_) {
+    MarkAll();
+    return;
+  }
+  for (size_t i = 0; i < bits_.size(); ++i) {
+    bits_[i] |= other.bits_[i];
+  }
+}
+
+int DirtyTileMap::GetDirtyCount() const {
+  int count = 0;
+  for (uint8_t byte : bits_) {
+    for (; byte; byte &= byte - 1) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+}  // namespace media
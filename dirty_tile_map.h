@@ -0,0 +1,60 @@
+#ifndef MEDIA_DIRTY_TILE_MAP_H_
+#define MEDIA_DIRTY_TILE_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace media {
+
+// Which square tiles of a frame changed since the previous capture, one bit
+// per tile in row-major order. Backends fill it from whatever change
+// tracking they have, so later stages only convert and encode what changed.
+class DirtyTileMap {
+ public:
+  // Sizes the map for a frame of width x height pixels and clears it.
+  // Edge tiles are clipped to the frame.
+  void Reset(int width, int height, int tile_size);
+
+  // Marks every tile, e.g. when the device cannot tell what changed
+  void MarkAll();
+
+  // Marks every tile a pixel rectangle overlaps
+  void MarkRect(int x, int y, int width, int height);
+
+  // Marks tiles from a change map with one byte per block_size square of
+  // pixels, non-zero meaning changed, as produced by NvFBC's diff map
+  void MarkBlocks(const uint8_t* blocks, int block_columns, int block_rows,
+                  int block_size);
+
+  bool IsDirty(int column, int row) const {
+    size_t index = static_cast<size_t>(row) * columns_ + column;
+    return (bits_[index / 8] >> (index % 8)) & 1;
+  }
+
+  // Adds the tiles marked in other, e.g. those of a frame dropped before
+  // delivery. Marks every tile if other was sized for a different frame
+  // or tile size. Does nothing to a map that was never sized.
+  void Merge(const DirtyTileMap& other);
+
+  // Number of dirty tiles
+  int GetDirtyCount() const;
+
+  int GetTileSize() const { return tile_size_; }
+  int GetColumns() const { return columns_; }
+  int GetRows() const { return rows_; }
+
+  // Packed bits, tile (column, row) at bit row * columns + column, least
+  // significant bit first
+  const std::vector<uint8_t>& GetBits() const { return bits_; }
+
+ private:
+  int tile_size_ = 0;
+  int columns_ = 0;
+  int rows_ = 0;
+  std::vector<uint8_t> bits_;
+};
+
+}  // namespace media
+
+#endif  // MEDIA_DIRTY_TILE_MAP_H_
@@ -0,0 +1,128 @@
+#include "frame_pool.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace media {
+
+namespace {
+
+uint8_t* AllocateAligned(size_t size) {
+#ifdef _WIN32
+  return static_cast<uint8_t*>(_aligned_malloc(size, kFrameBufferAlignment));
+#else
+  void* memory = nullptr;
+  if (posix_memalign(&memory, kFrameBufferAlignment, size) != 0) {
+    return nullptr;
+  }
+  return static_cast<uint8_t*>(memory);
+#endif
+}
+
+void FreeAligned(uint8_t* data) {
+#ifdef _WIN32
+  _aligned_free(data);
+#else
+  free(data);
+#endif
+}
+
+}  // namespace
+
+// Idle buffers, shared with every outstanding buffer so releases that
+// happen after the pool is gone still have somewhere safe to land
+struct FrameBuffer::PoolState {
+  std::mutex mutex;
+  std::vector<FrameBuffer*> free_buffers;  // Capacity reserved up front
+  size_t max_free = 0;
+  bool closed = false;
+};
+
+FrameBuffer::FrameBuffer(std::shared_ptr<PoolState> pool, uint8_t* data,
+                         size_t capacity)
+    : pool_(std::move(pool)), data_(data), capacity_(capacity) {}
+
+FrameBuffer::~FrameBuffer() {
+  FreeAligned(data_);
+}
+
+void FrameBuffer::Release() {
+  if (refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+
+  // Last reference: park the buffer for reuse unless the pool is full
+  {
+    std::lock_guard<std::mutex> lock(pool_->mutex);
+    if (!pool_->closed && pool_->free_buffers.size() < pool_->max_free) {
+      pool_->free_buffers.push_back(this);
+      return;
+    }
+  }
+  delete this;
+}
+
+FramePool::FramePool(size_t max_free) : state_(new FrameBuffer::PoolState()) {
+  state_->max_free = max_free;
+  state_->free_buffers.reserve(max_free);
+}
+
+FramePool::~FramePool() {
+  std::vector<FrameBuffer*> idle;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->closed = true;
+    idle.swap(state_->free_buffers);
+  }
+  for (FrameBuffer* buffer : idle) {
+    delete buffer;
+  }
+}
+
+FrameRef FramePool::Acquire(size_t size) {
+  FrameBuffer* buffer = nullptr;
+  FrameBuffer* too_small = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    std::vector<FrameBuffer*>& idle = state_->free_buffers;
+    for (size_t i = 0; i < idle.size(); ++i) {
+      if (idle[i]->capacity() >= size) {
+        buffer = idle[i];
+        idle[i] = idle.back();
+        idle.pop_back();
+        break;
+      }
+    }
+
+    // The frame size changed; retire an idle buffer rather than growing
+    // the pool past its limit
+    if (!buffer && !idle.empty() && idle.size() == state_->max_free) {
+      too_small = idle.back();
+      idle.pop_back();
+    }
+  }
+  delete too_small;
+
+  if (!buffer) {
+    // Round up so padded strides and odd sizes still land on a cache line
+    size_t capacity = (size + kFrameBufferAlignment - 1) &
+                      ~(kFrameBufferAlignment - 1);
+    uint8_t* data = AllocateAligned(capacity ? capacity : kFrameBufferAlignment);
+    if (!data) {
+      std::cerr << "Failed to allocate frame buffer of " << size << " bytes" << std::endl;
+      return FrameRef();
+    }
+    buffer = new FrameBuffer(state_, data, capacity);
+  }
+
+  buffer->size_ = size;
+  return FrameRef(buffer);
+}
+
+}  // namespace media
@@ -0,0 +1,114 @@
+#ifndef MEDIA_FRAME_POOL_H_
+#define MEDIA_FRAME_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace media {
+
+class FramePool;
+class FrameRef;
+
+// Byte alignment of every pooled frame buffer, one cache line
+constexpr size_t kFrameBufferAlignment = 64;
+
+// Reference counted frame memory owned by a FramePool. Handed out through
+// FrameRef; the buffer goes back to its pool when the last reference drops.
+class FrameBuffer {
+ public:
+  uint8_t* data() { return data_; }
+  const uint8_t* data() const { return data_; }
+
+  // Bytes in use by the current frame, at most capacity()
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+
+ private:
+  friend class FramePool;
+  friend class FrameRef;
+
+  struct PoolState;
+
+  FrameBuffer(std::shared_ptr<PoolState> pool, uint8_t* data, size_t capacity);
+  ~FrameBuffer();
+
+  FrameBuffer(const FrameBuffer&) = delete;
+  FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+  void AddRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+  void Release();
+
+  std::atomic<int> refs_{0};
+  std::shared_ptr<PoolState> pool_;
+  uint8_t* data_;
+  size_t size_ = 0;
+  size_t capacity_;
+};
+
+// Shared handle to a FrameBuffer. Copies share the same memory.
+class FrameRef {
+ public:
+  FrameRef() = default;
+  FrameRef(const FrameRef& other) : buffer_(other.buffer_) {
+    if (buffer_) buffer_->AddRef();
+  }
+  FrameRef(FrameRef&& other) noexcept : buffer_(other.buffer_) {
+    other.buffer_ = nullptr;
+  }
+  ~FrameRef() { Reset(); }
+
+  FrameRef& operator=(FrameRef other) noexcept {
+    FrameBuffer* buffer = buffer_;
+    buffer_ = other.buffer_;
+    other.buffer_ = buffer;
+    return *this;
+  }
+
+  // Drops this reference, recycling the buffer if it was the last one
+  void Reset() {
+    if (buffer_) {
+      buffer_->Release();
+      buffer_ = nullptr;
+    }
+  }
+
+  explicit operator bool() const { return buffer_ != nullptr; }
+  FrameBuffer* operator->() const { return buffer_; }
+  FrameBuffer* get() const { return buffer_; }
+
+ private:
+  friend class FramePool;
+
+  explicit FrameRef(FrameBuffer* buffer) : buffer_(buffer) {
+    if (buffer_) buffer_->AddRef();
+  }
+
+  FrameBuffer* buffer_ = nullptr;
+};
+
+// Recycles frame buffers so a steady capture loop does not allocate. Buffers
+// may outlive the pool; they are freed instead of recycled in that case.
+// Acquire may be called from one thread while references are released on
+// others.
+class FramePool {
+ public:
+  // max_free is how many idle buffers are kept for reuse
+  explicit FramePool(size_t max_free = 3);
+  ~FramePool();
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // Returns a buffer of at least size bytes, reusing an idle one when it is
+  // large enough. Returns an empty FrameRef if allocation fails.
+  FrameRef Acquire(size_t size);
+
+ private:
+  std::shared_ptr<FrameBuffer::PoolState> state_;
+};
+
+}  // namespace media
+
+#endif  // MEDIA_FRAME_POOL_H_
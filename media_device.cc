@@ -10,7 +10,16 @@
 #include "pulse_audio_device.h"
 #endif
 
-#include <cstring> // For memcpy
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "pixel_kernels.h"
+#include "sample_convert.h"
+#include "delivery_queue.h"
+#include "triple_buffer.h"
 
 namespace media {
 
@@ -18,6 +27,253 @@ namespace media {
 // VideoDevice implementation
 //
 
+namespace {
+
+int PlaneCount(PixelFormat format) {
+  switch (format) {
+    case PixelFormat::BGRA: return 1;
+    case PixelFormat::NV12: return 2;
+    case PixelFormat::I420: return 3;
+  }
+  return 0;
+}
+
+// Bytes per row and number of rows of one plane, without padding
+void PlaneSize(PixelFormat format, int width, int height, int plane,
+               int* row_bytes, int* rows) {
+  int chroma_width = (width + 1) / 2;
+  int chroma_height = (height + 1) / 2;
+  switch (format) {
+    case PixelFormat::BGRA:
+      *row_bytes = width * 4;
+      *rows = height;
+      return;
+    case PixelFormat::NV12:
+      *row_bytes = plane == 0 ? width : chroma_width * 2;
+      *rows = plane == 0 ? height : chroma_height;
+      return;
+    case PixelFormat::I420:
+      *row_bytes = plane == 0 ? width : chroma_width;
+      *rows = plane == 0 ? height : chroma_height;
+      return;
+  }
+}
+
+// Checks that caller supplied planes are set and wide enough
+bool ValidatePlanes(const Frame& frame, int width, int height) {
+  for (int plane = 0; plane < PlaneCount(frame.format); ++plane) {
+    int row_bytes = 0;
+    int rows = 0;
+    PlaneSize(frame.format, width, height, plane, &row_bytes, &rows);
+    if (!frame.planes[plane] || frame.pitches[plane] < row_bytes) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// True if the caller supplied the planes. Planes into a pooled buffer the
+// frame still holds came from an earlier capture; writing to them would
+// hand the buffer back to the pool while it is in use, so they are
+// replaced instead.
+bool HasCallerPlanes(const Frame& frame) {
+  return frame.planes[0] != nullptr && !frame.buffer;
+}
+
+// Points the frame at a tightly packed buffer and takes a reference to it
+void AttachPackedBuffer(Frame* frame, FrameRef buffer, int width, int height) {
+  uint8_t* data = buffer->data();
+  for (int plane = 0; plane < 3; ++plane) {
+    int row_bytes = 0;
+    int rows = 0;
+    if (plane < PlaneCount(frame->format)) {
+      PlaneSize(frame->format, width, height, plane, &row_bytes, &rows);
+      frame->planes[plane] = data;
+      data += static_cast<size_t>(row_bytes) * rows;
+    } else {
+      frame->planes[plane] = nullptr;
+    }
+    frame->pitches[plane] = row_bytes;
+  }
+  frame->width = width;
+  frame->height = height;
+  frame->buffer = std::move(buffer);
+}
+
+// Copies a tightly packed capture plane by plane to the caller's pitches
+bool CopyPackedFrame(const uint8_t* src, int width, int height, Frame* frame) {
+  if (!ValidatePlanes(*frame, width, height)) {
+    return false;
+  }
+  for (int plane = 0; plane < PlaneCount(frame->format); ++plane) {
+    int row_bytes = 0;
+    int rows = 0;
+    PlaneSize(frame->format, width, height, plane, &row_bytes, &rows);
+    CopyRows(src, row_bytes, frame->planes[plane], frame->pitches[plane], row_bytes, rows);
+    src += static_cast<size_t>(row_bytes) * rows;
+  }
+  frame->width = width;
+  frame->height = height;
+  frame->buffer.Reset();
+  return true;
+}
+
+// Hands a tightly packed capture to the caller: adopted as is when no
+// planes were supplied, otherwise copied to them
+bool DeliverPackedFrame(Frame* frame, FrameRef packed, int width, int height) {
+  if (!HasCallerPlanes(*frame)) {
+    AttachPackedBuffer(frame, std::move(packed), width, height);
+    return true;
+  }
+  return CopyPackedFrame(packed->data(), width, height, frame);
+}
+
+// Copies a frame into the caller's planes, which may have other pitches
+bool CopyFrame(const Frame& src, Frame* dst) {
+  if (dst->format != src.format || !ValidatePlanes(*dst, src.width, src.height)) {
+    return false;
+  }
+  for (int plane = 0; plane < PlaneCount(src.format); ++plane) {
+    int row_bytes = 0;
+    int rows = 0;
+    PlaneSize(src.format, src.width, src.height, plane, &row_bytes, &rows);
+    CopyRows(src.planes[plane], src.pitches[plane],
+             dst->planes[plane], dst->pitches[plane], row_bytes, rows);
+  }
+  dst->width = src.width;
+  dst->height = src.height;
+  dst->timestamp_us = src.timestamp_us;
+  dst->sequence = src.sequence;
+  dst->missed_frames = src.missed_frames;
+  dst->dirty_tiles = src.dirty_tiles;
+  dst->buffer.Reset();
+  return true;
+}
+
+// Sleeps until the next tick of a fixed rate, skipping ahead rather than
+// bursting after a stall
+void SleepUntilNextTick(std::chrono::steady_clock::time_point* next_tick,
+                        std::chrono::microseconds period) {
+  *next_tick += period;
+  auto now = std::chrono::steady_clock::now();
+  if (*next_tick < now) {
+    *next_tick = now;
+  }
+  std::this_thread::sleep_until(*next_tick);
+}
+
+std::chrono::microseconds PeriodFromFps(int fps) {
+  return std::chrono::microseconds(1000000 / (fps > 0 ? fps : 60));
+}
+
+// Longest a subscription blocks in WaitForFrame, so it notices being stopped
+constexpr int kSubscriptionWaitMs = 100;
+
+// Captures from a video device on its own thread, waiting for changes or
+// polling at a fixed rate, and delivers new frames through a DeliveryQueue
+class VideoSubscription : public Subscription {
+ public:
+  VideoSubscription(VideoDevice* device, FrameCallback callback,
+                    const SubscribeOptions& options)
+      : device_(device),
+        format_(options.format),
+        period_(PeriodFromFps(options.fps)),
+        queue_(std::move(callback), options.backpressure, options.queue_depth) {
+    device_->DetachThread();
+    thread_ = std::thread(&VideoSubscription::CaptureLoop, this);
+  }
+  
+  ~VideoSubscription() override {
+    running_ = false;
+    queue_.Stop();
+    thread_.join();
+    device_->AttachThread();
+  }
+  
+ private:
+  void CaptureLoop() {
+    device_->AttachThread();
+    
+    // Devices that can wait are woken by changes instead of polled. The
+    // tick still caps the rate; after a timed out wait it has already
+    // passed and does not sleep.
+    const bool wait = device_->CanWaitForFrame();
+    Frame frame;
+    bool delivered = false;
+    uint64_t last_sequence = 0;
+    auto next_tick = std::chrono::steady_clock::now();
+    while (running_) {
+      frame = Frame();
+      frame.format = format_;
+      bool captured = wait ? device_->WaitForFrame(&frame, kSubscriptionWaitMs)
+                           : device_->GetFrame(&frame);
+      
+      // Devices serving a latest frame return the same one until it
+      // changes; only deliver each frame once
+      if (captured && (!delivered || frame.sequence != last_sequence)) {
+        delivered = true;
+        last_sequence = frame.sequence;
+        queue_.Push(&frame);
+      }
+      SleepUntilNextTick(&next_tick, period_);
+    }
+    
+    device_->DetachThread();
+  }
+  
+  VideoDevice* device_;
+  PixelFormat format_;
+  std::chrono::microseconds period_;
+  DeliveryQueue<Frame> queue_;
+  std::atomic<bool> running_{true};
+  std::thread thread_;
+};
+
+// Longest an audio subscription sleeps between failed reads
+constexpr int kAudioMaxRetryMs = 50;
+
+// Reads an audio device on its own thread and delivers each packet through
+// a DeliveryQueue. Packet buffers cycle between the two threads.
+class AudioSubscription : public Subscription {
+ public:
+  AudioSubscription(AudioDevice* device, AudioCallback callback,
+                    const SubscribeOptions& options)
+      : device_(device),
+        queue_(std::move(callback), options.backpressure, options.queue_depth) {
+    thread_ = std::thread(&AudioSubscription::CaptureLoop, this);
+  }
+  
+  ~AudioSubscription() override {
+    running_ = false;
+    queue_.Stop();
+    thread_.join();
+  }
+  
+ private:
+  void CaptureLoop() {
+    // GetPacket returns at once when no data is ready (read_timeout_ms 0)
+    // or the stream has failed, so back off instead of spinning
+    AudioPacket packet;
+    int retry_ms = 0;
+    while (running_) {
+      if (device_->GetPacket(&packet)) {
+        queue_.Push(&packet);
+        retry_ms = 0;
+      } else {
+        retry_ms = std::min(std::max(retry_ms * 2, 1), kAudioMaxRetryMs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(retry_ms));
+      }
+    }
+  }
+  
+  AudioDevice* device_;
+  DeliveryQueue<AudioPacket> queue_;
+  std::atomic<bool> running_{true};
+  std::thread thread_;
+};
+
+}  // namespace
+
 // Implementation classes - defined in the cc file to hide platform-specific details
 #ifdef _WIN32
 // Windows video device implementation
@@ -33,8 +289,22 @@ class DXGIVideoDeviceImpl : public VideoDevice {
     return device_->GetFrameBGRA(bgra_data) == 1;
   }
   
+  bool GetFrameBGRA(FrameRef* frame) override {
+    if (!frame) {
+      return false;
+    }
+    FrameRef buffer = frame_pool_.Acquire(
+        static_cast<size_t>(device_->GetWidth()) * device_->GetHeight() * 4);
+    if (!buffer || device_->GetFrameBGRA(buffer->data()) != 1) {
+      return false;
+    }
+    *frame = std::move(buffer);
+    return true;
+  }
+  
  private:
   std::unique_ptr<DXGIVideoDevice> device_;
+  FramePool frame_pool_;
 };
 #else
 // Linux video device implementations
@@ -50,8 +320,123 @@ class X11VideoDeviceImpl : public VideoDevice {
     return device_->GetFrameBGRA(bgra_data);
   }
   
+  bool GetFrameBGRA(FrameRef* frame) override {
+    return device_->GetFrameBGRA(frame);
+  }
+  
+  bool GetDirtyFrameBGRA(uint8_t* bgra_data, std::vector<Rect>* dirty_rects) override {
+    if (!dirty_rects || !device_->GetDirtyFrameBGRA(bgra_data, &x11_rects_)) {
+      return false;
+    }
+    dirty_rects->clear();
+    for (const X11Rect& rect : x11_rects_) {
+      dirty_rects->push_back(Rect{rect.x, rect.y, rect.width, rect.height});
+    }
+    return true;
+  }
+  
+  bool GetFrameYUV420(std::vector<uint8_t>* data) override {
+    return device_->GetFrameYUV420(data);
+  }
+  
+  bool GetFrameNV12(std::vector<uint8_t>* data) override {
+    return device_->GetFrameNV12(data);
+  }
+  
+  bool GetFrameYUV420(FrameRef* frame) override {
+    return device_->GetFrameYUV420(frame);
+  }
+  
+  bool GetFrameNV12(FrameRef* frame) override {
+    return device_->GetFrameNV12(frame);
+  }
+  
+  bool GetFrame(Frame* frame) override {
+    if (!frame) {
+      return false;
+    }
+    
+    // Without caller planes, capture into a pooled packed buffer
+    int width = device_->GetWidth();
+    int height = device_->GetHeight();
+    if (!HasCallerPlanes(*frame)) {
+      FrameRef buffer;
+      bool success = false;
+      switch (frame->format) {
+        case PixelFormat::BGRA: success = device_->GetFrameBGRA(&buffer); break;
+        case PixelFormat::NV12: success = device_->GetFrameNV12(&buffer); break;
+        case PixelFormat::I420: success = device_->GetFrameYUV420(&buffer); break;
+      }
+      if (!success) {
+        return false;
+      }
+      AttachPackedBuffer(frame, std::move(buffer), width, height);
+      StampFrame(frame, device_->GetCaptureTimeUs());
+      return true;
+    }
+    
+    // Otherwise write straight into them at their pitches
+    if (!ValidatePlanes(*frame, width, height)) {
+      return false;
+    }
+    bool success = false;
+    switch (frame->format) {
+      case PixelFormat::BGRA:
+        success = device_->GetFrameBGRA(frame->planes[0], frame->pitches[0]);
+        break;
+      case PixelFormat::NV12:
+        success = device_->GetFrameNV12(frame->planes[0], frame->pitches[0],
+                                        frame->planes[1], frame->pitches[1]);
+        break;
+      case PixelFormat::I420:
+        success = device_->GetFrameYUV420(frame->planes[0], frame->pitches[0],
+                                          frame->planes[1], frame->pitches[1],
+                                          frame->planes[2], frame->pitches[2]);
+        break;
+    }
+    if (!success) {
+      return false;
+    }
+    frame->width = width;
+    frame->height = height;
+    frame->buffer.Reset();
+    StampFrame(frame, device_->GetCaptureTimeUs());
+    return true;
+  }
+  
+  int64_t GetLastFrameTimestampUs() const override {
+    return device_->GetCaptureTimeUs();
+  }
+  
+  // Damage events tell when the screen changed
+  bool WaitForFrame(Frame* frame, int timeout_ms) override {
+    return device_->WaitForDamage(timeout_ms) && GetFrame(frame);
+  }
+  
+  bool CanWaitForFrame() const override { return device_->HasDamage(); }
+  
+  bool AcquireFrameBGRA(FrameLease* lease) override {
+    X11FrameLease x11_lease;
+    if (!lease || !device_->AcquireFrame(&x11_lease)) {
+      return false;
+    }
+    lease->data = x11_lease.data;
+    lease->width = x11_lease.width;
+    lease->height = x11_lease.height;
+    lease->stride = x11_lease.stride;
+    lease->id = x11_lease.index;
+    return true;
+  }
+  
+  void ReleaseFrame(const FrameLease& lease) override {
+    X11FrameLease x11_lease;
+    x11_lease.index = lease.id;
+    device_->ReleaseFrame(x11_lease);
+  }
+  
  private:
   std::unique_ptr<X11VideoDevice> device_;
+  std::vector<X11Rect> x11_rects_;
 };
 
 class NVFBCVideoDeviceImpl : public VideoDevice {
@@ -63,24 +448,298 @@ class NVFBCVideoDeviceImpl : public VideoDevice {
   int GetHeight() const override { return device_->GetHeight(); }
   
   bool GetFrameBGRA(uint8_t* bgra_data) override {
-    std::vector<uint8_t> buffer;
-    bool success = device_->GetFrameBGRA(&buffer);
-    if (success && !buffer.empty()) {
-      std::memcpy(bgra_data, buffer.data(), buffer.size());
+    // One copy, straight out of NvFBC's buffer
+    NVFBCFrameView view;
+    if (!bgra_data || !device_->BorrowFrame(NVFBC_BUFFER_FORMAT_BGRA, &view)) {
+      return false;
     }
-    return success;
+    CopyRows(view.data, view.size, bgra_data, view.size, view.size, 1);
+    return true;
+  }
+  
+  bool GetFrameBGRA(FrameRef* frame) override {
+    return device_->GetFrame(NVFBC_BUFFER_FORMAT_BGRA, frame);
   }
   
   bool GetFrameNV12(std::vector<uint8_t>* data) override {
     return device_->GetFrameNV12(data);
   }
   
+  bool GetFrameNV12(FrameRef* frame) override {
+    return device_->GetFrame(NVFBC_BUFFER_FORMAT_NV12, frame);
+  }
+  
+  bool AcquireFrameBGRA(FrameLease* lease) override {
+    return LeaseFrame(NVFBC_BUFFER_FORMAT_BGRA, 4, lease);
+  }
+  
+  bool AcquireFrameNV12(FrameLease* lease) override {
+    return LeaseFrame(NVFBC_BUFFER_FORMAT_NV12, 1, lease);
+  }
+  
+  // Nothing to return; the next grab reuses the buffer
+  void ReleaseFrame([[maybe_unused]] const FrameLease& lease) override {}
+  
+  bool GetFrame(Frame* frame) override {
+    NVFBC_BUFFER_FORMAT format;
+    if (!frame || !ToNvFBCFormat(frame->format, &format)) {
+      return false;
+    }
+    
+    // Caller's planes are filled straight from NvFBC's buffer. Without
+    // them the frame needs a pooled buffer of its own, since NvFBC's is
+    // overwritten by the next grab.
+    if (HasCallerPlanes(*frame)) {
+      NVFBCFrameView view;
+      if (!device_->BorrowFrame(format, &view) ||
+          !CopyPackedFrame(view.data, view.width, view.height, frame)) {
+        return false;
+      }
+    } else {
+      FrameRef packed;
+      if (!device_->GetFrame(format, &packed) ||
+          !DeliverPackedFrame(frame, std::move(packed),
+                              device_->GetWidth(), device_->GetHeight())) {
+        return false;
+      }
+    }
+    FinishFrame(frame);
+    return true;
+  }
+  
+  // The grab itself sleeps in the driver until the screen is redrawn
+  bool WaitForFrame(Frame* frame, int timeout_ms) override {
+    NVFBC_BUFFER_FORMAT format;
+    FrameRef packed;
+    if (!frame || !ToNvFBCFormat(frame->format, &format) ||
+        !device_->WaitForFrame(format, std::max(timeout_ms, 1), &packed) ||
+        !DeliverPackedFrame(frame, std::move(packed),
+                            device_->GetWidth(), device_->GetHeight())) {
+      return false;
+    }
+    FinishFrame(frame);
+    return true;
+  }
+  
+  bool CanWaitForFrame() const override { return true; }
+  
+  int64_t GetLastFrameTimestampUs() const override {
+    return device_->GetLastFrameInfo().timestamp_us;
+  }
+  
+  bool IsFrameUnchanged() const override {
+    return device_->GetLastFrameInfo().skipped;
+  }
+  
+  // The NvFBC context follows the thread that grabs
+  void AttachThread() override { device_->BindContext(); }
+  void DetachThread() override { device_->ReleaseContext(); }
+  
  private:
+  // NvFBC has no I420 output; BGRA and NV12 come back tightly packed
+  static bool ToNvFBCFormat(PixelFormat format, NVFBC_BUFFER_FORMAT* nvfbc_format) {
+    switch (format) {
+      case PixelFormat::BGRA: *nvfbc_format = NVFBC_BUFFER_FORMAT_BGRA; return true;
+      case PixelFormat::NV12: *nvfbc_format = NVFBC_BUFFER_FORMAT_NV12; return true;
+      default: return false;
+    }
+  }
+  
+  // Fills in what NvFBC reported about the frame just grabbed
+  void FinishFrame(Frame* frame) {
+    StampFrame(frame, device_->GetLastFrameInfo().timestamp_us);
+    frame->missed_frames = device_->GetLastFrameInfo().missed_frames;
+    if (GetDirtyTileSize() > 0) {
+      device_->GetDirtyTiles(GetDirtyTileSize(), &frame->dirty_tiles);
+    }
+  }
+  
+  bool LeaseFrame(NVFBC_BUFFER_FORMAT format, int bytes_per_pixel, FrameLease* lease) {
+    NVFBCFrameView view;
+    if (!lease || !device_->BorrowFrame(format, &view)) {
+      return false;
+    }
+    lease->data = view.data;
+    lease->width = view.width;
+    lease->height = view.height;
+    lease->stride = view.width * bytes_per_pixel;
+    lease->id = 0;
+    return true;
+  }
+  
   std::unique_ptr<NVFBCVideoDevice> device_;
 };
 #endif
 
+// Runs another device on a background thread at a fixed rate and serves
+// the latest frame through a triple buffer. Frames are pooled buffers, so
+// handing one out only takes a reference.
+class AsyncVideoDeviceImpl : public VideoDevice {
+ public:
+  AsyncVideoDeviceImpl(std::unique_ptr<VideoDevice> device,
+                       const VideoDeviceConfig& config)
+      : device_(std::move(device)),
+        format_(config.async_format),
+        period_(PeriodFromFps(config.async_fps)) {
+    // Hand thread-bound state over to the capture thread
+    device_->DetachThread();
+    thread_ = std::thread(&AsyncVideoDeviceImpl::CaptureLoop, this);
+  }
+  
+  ~AsyncVideoDeviceImpl() override {
+    running_ = false;
+    thread_.join();
+    
+    // Take the state back so the device can be destroyed here
+    device_->AttachThread();
+  }
+  
+  int GetWidth() const override { return device_->GetWidth(); }
+  int GetHeight() const override { return device_->GetHeight(); }
+  
+  bool GetFrameBGRA(uint8_t* bgra_data) override {
+    Frame frame;
+    frame.format = PixelFormat::BGRA;
+    frame.planes[0] = bgra_data;
+    frame.pitches[0] = GetWidth() * 4;
+    return bgra_data && GetFrame(&frame);
+  }
+  
+  bool GetFrameBGRA(FrameRef* frame) override {
+    return GetLatestBuffer(PixelFormat::BGRA, frame);
+  }
+  
+  bool GetFrame(Frame* frame) override {
+    if (!frame) {
+      return false;
+    }
+    const Frame* latest = Latest(frame->format);
+    if (!latest) {
+      return false;
+    }
+    if (!HasCallerPlanes(*frame)) {
+      *frame = *latest;
+      return true;
+    }
+    return CopyFrame(*latest, frame);
+  }
+  
+  int64_t GetLastFrameTimestampUs() const override {
+    return served_timestamp_us_;
+  }
+  
+  // Wakes when the capture thread publishes a frame not yet waited for
+  bool WaitForFrame(Frame* frame, int timeout_ms) override {
+    {
+      std::unique_lock<std::mutex> lock(publish_mutex_);
+      if (!published_.wait_for(lock, std::chrono::milliseconds(std::max(timeout_ms, 0)),
+                               [this] { return published_count_ != waited_count_; })) {
+        return false;
+      }
+      waited_count_ = published_count_;
+    }
+    return GetFrame(frame);
+  }
+  
+  bool CanWaitForFrame() const override { return true; }
+  
+#ifndef _WIN32
+  bool GetFrameYUV420(std::vector<uint8_t>* data) override {
+    return GetLatestPacked(PixelFormat::I420, data);
+  }
+  
+  bool GetFrameNV12(std::vector<uint8_t>* data) override {
+    return GetLatestPacked(PixelFormat::NV12, data);
+  }
+  
+  bool GetFrameYUV420(FrameRef* frame) override {
+    return GetLatestBuffer(PixelFormat::I420, frame);
+  }
+  
+  bool GetFrameNV12(FrameRef* frame) override {
+    return GetLatestBuffer(PixelFormat::NV12, frame);
+  }
+#endif
+  
+ private:
+  void CaptureLoop() {
+    device_->AttachThread();
+    
+    auto next_tick = std::chrono::steady_clock::now();
+    while (running_) {
+      // Clear the slot first so its old buffer goes back to the pool
+      Frame& slot = frames_.back();
+      slot = Frame();
+      slot.format = format_;
+      if (device_->GetFrame(&slot)) {
+        // A frame never picked up is replaced by this one, which then
+        // carries its changes too; at worst the consumer gets a superset
+        if (frames_.HasUnread()) {
+          FoldDropped(unread_, &slot);
+        }
+        unread_.dirty_tiles = slot.dirty_tiles;
+        unread_.missed_frames = slot.missed_frames;
+        frames_.Publish();
+        std::lock_guard<std::mutex> lock(publish_mutex_);
+        ++published_count_;
+        published_.notify_one();
+      }
+      SleepUntilNextTick(&next_tick, period_);
+    }
+    
+    device_->DetachThread();
+  }
+  
+  // Most recent complete frame, or null if none is available in format
+  const Frame* Latest(PixelFormat format) {
+    frames_.Update();
+    const Frame& latest = frames_.front();
+    if (format != format_ || !latest.buffer) {
+      return nullptr;
+    }
+    served_timestamp_us_ = latest.timestamp_us;
+    return &latest;
+  }
+  
+  bool GetLatestBuffer(PixelFormat format, FrameRef* frame) {
+    const Frame* latest = Latest(format);
+    if (!frame || !latest) {
+      return false;
+    }
+    *frame = latest->buffer;
+    return true;
+  }
+  
+  bool GetLatestPacked(PixelFormat format, std::vector<uint8_t>* data) {
+    const Frame* latest = Latest(format);
+    if (!data || !latest) {
+      return false;
+    }
+    const uint8_t* begin = latest->buffer->data();
+    data->assign(begin, begin + latest->buffer->size());
+    return true;
+  }
+  
+  std::unique_ptr<VideoDevice> device_;
+  PixelFormat format_;
+  std::chrono::microseconds period_;
+  TripleBuffer<Frame> frames_;
+  Frame unread_;  // Changes of the last published frame, capture thread only
+  int64_t served_timestamp_us_ = 0;  // Of the frame last handed out
+  
+  // Counts publishes so WaitForFrame can sleep until the next one
+  std::mutex publish_mutex_;
+  std::condition_variable published_;
+  uint64_t published_count_ = 0;
+  uint64_t waited_count_ = 0;  // Consumer only, read under the mutex
+  
+  std::atomic<bool> running_{true};
+  std::thread thread_;
+};
+
 std::unique_ptr<VideoDevice> VideoDevice::Create(const VideoDeviceConfig& config) {
+  std::unique_ptr<VideoDevice> device;
+  
 #ifdef _WIN32
   // Windows implementation
   if (config.type == VideoDeviceType::DXGI) {
@@ -90,7 +749,7 @@ std::unique_ptr<VideoDevice> VideoDevice::Create(const VideoDeviceConfig& config
     
     auto dxgi_device = DXGIVideoDevice::Create(dxgi_config);
     if (dxgi_device) {
-      return std::make_unique<DXGIVideoDeviceImpl>(std::move(dxgi_device));
+      device = std::make_unique<DXGIVideoDeviceImpl>(std::move(dxgi_device));
     }
   }
 #else
@@ -100,25 +759,125 @@ std::unique_ptr<VideoDevice> VideoDevice::Create(const VideoDeviceConfig& config
     x11_config.cursor = config.capture_cursor;
     x11_config.display_id = config.display_id;
     x11_config.use_shm = config.use_shm;
+    x11_config.use_damage = config.use_damage;
+    x11_config.shm_segments = config.shm_segments;
+    x11_config.color_matrix = config.color_matrix;
+    x11_config.color_range = config.color_range;
+    x11_config.worker_threads = config.worker_threads;
     
     auto x11_device = X11VideoDevice::Create(x11_config);
     if (x11_device) {
-      return std::make_unique<X11VideoDeviceImpl>(std::move(x11_device));
+      device = std::make_unique<X11VideoDeviceImpl>(std::move(x11_device));
     }
   } else if (config.type == VideoDeviceType::NVFBC) {
     NVFBCVideoDeviceConfig nvfbc_config;
     nvfbc_config.cursor = config.capture_cursor;
     nvfbc_config.display_id = config.display_id;
+    nvfbc_config.grab_mode = config.wait_for_new_frame ? NVFBCGrabMode::NEW_FRAME
+                                                       : NVFBCGrabMode::NOWAIT;
+    nvfbc_config.grab_timeout_ms = config.new_frame_timeout_ms;
+    nvfbc_config.skip_unchanged = config.skip_unchanged;
+    nvfbc_config.push_model = config.push_model;
+    nvfbc_config.sampling_rate_ms = config.sampling_rate_ms;
+    nvfbc_config.diff_map_block_size = std::max(config.dirty_tile_size, 0);
+    nvfbc_config.output_name = config.output_name;
+    nvfbc_config.capture_box.x = static_cast<uint32_t>(std::max(config.capture_region.x, 0));
+    nvfbc_config.capture_box.y = static_cast<uint32_t>(std::max(config.capture_region.y, 0));
+    nvfbc_config.capture_box.w = static_cast<uint32_t>(std::max(config.capture_region.width, 0));
+    nvfbc_config.capture_box.h = static_cast<uint32_t>(std::max(config.capture_region.height, 0));
+    nvfbc_config.frame_size.w = static_cast<uint32_t>(std::max(config.output_width, 0));
+    nvfbc_config.frame_size.h = static_cast<uint32_t>(std::max(config.output_height, 0));
     
     auto nvfbc_device = NVFBCVideoDevice::Create(nvfbc_config);
     if (nvfbc_device) {
-      return std::make_unique<NVFBCVideoDeviceImpl>(std::move(nvfbc_device));
+      device = std::make_unique<NVFBCVideoDeviceImpl>(std::move(nvfbc_device));
     }
   }
 #endif
 
-  // Return nullptr if no suitable device could be created
-  return nullptr;
+  // Null if no suitable device could be created
+  if (device) {
+    device->dirty_tile_size_ = std::max(config.dirty_tile_size, 0);
+  }
+  if (device && config.async_capture) {
+    return std::make_unique<AsyncVideoDeviceImpl>(std::move(device), config);
+  }
+  return device;
+}
+
+std::future<std::unique_ptr<VideoDevice>> VideoDevice::CreateAsync(
+    const VideoDeviceConfig& config) {
+  return std::async(std::launch::async, [config]() {
+    std::unique_ptr<VideoDevice> device = Create(config);
+    if (device) {
+      device->DetachThread();
+    }
+    return device;
+  });
+}
+
+bool VideoDevice::GetDirtyFrameBGRA(uint8_t* bgra_data, std::vector<Rect>* dirty_rects) {
+  if (!dirty_rects || !GetFrameBGRA(bgra_data)) {
+    return false;
+  }
+  dirty_rects->assign(1, Rect{0, 0, GetWidth(), GetHeight()});
+  return true;
+}
+
+bool VideoDevice::AcquireFrameBGRA([[maybe_unused]] FrameLease* lease) {
+  return false;  // Not supported by default
+}
+
+void VideoDevice::ReleaseFrame([[maybe_unused]] const FrameLease& lease) {
+}
+
+bool VideoDevice::GetFrameBGRA([[maybe_unused]] FrameRef* frame) {
+  return false;  // Not supported by default
+}
+
+bool VideoDevice::GetFrame(Frame* frame) {
+  if (!frame || frame->format != PixelFormat::BGRA) {
+    return false;  // Only BGRA by default
+  }
+  
+  FrameRef packed;
+  if (!GetFrameBGRA(&packed) ||
+      !DeliverPackedFrame(frame, std::move(packed), GetWidth(), GetHeight())) {
+    return false;
+  }
+  StampFrame(frame);
+  return true;
+}
+
+bool VideoDevice::WaitForFrame(Frame* frame, [[maybe_unused]] int timeout_ms) {
+  return GetFrame(frame);  // Cannot wait, see CanWaitForFrame
+}
+
+std::unique_ptr<Subscription> VideoDevice::Subscribe(FrameCallback callback,
+                                                     const SubscribeOptions& options) {
+  if (!callback) {
+    return nullptr;
+  }
+  return std::make_unique<VideoSubscription>(this, std::move(callback), options);
+}
+
+int64_t VideoDevice::GetLastFrameTimestampUs() const {
+  return last_timestamp_us_;
+}
+
+void VideoDevice::StampFrame(Frame* frame, int64_t timestamp_us) {
+  frame->timestamp_us = timestamp_us != 0 ? timestamp_us : GetCaptureClockUs();
+  frame->sequence = frame_sequence_++;
+  frame->missed_frames = 0;
+  last_timestamp_us_ = frame->timestamp_us;
+  
+  // Without change tracking everything may have changed
+  if (dirty_tile_size_ > 0) {
+    frame->dirty_tiles.Reset(frame->width, frame->height, dirty_tile_size_);
+    frame->dirty_tiles.MarkAll();
+  } else {
+    frame->dirty_tiles = DirtyTileMap();
+  }
 }
 
 #ifndef _WIN32
@@ -130,6 +889,18 @@ bool VideoDevice::GetFrameYUV420(std::vector<uint8_t>* data) {
 bool VideoDevice::GetFrameNV12(std::vector<uint8_t>* data) {
   return false;  // Not supported by default
 }
+
+bool VideoDevice::GetFrameYUV420([[maybe_unused]] FrameRef* frame) {
+  return false;  // Not supported by default
+}
+
+bool VideoDevice::GetFrameNV12([[maybe_unused]] FrameRef* frame) {
+  return false;  // Not supported by default
+}
+
+bool VideoDevice::AcquireFrameNV12([[maybe_unused]] FrameLease* lease) {
+  return false;  // Not supported by default
+}
 #endif
 
 //
@@ -149,6 +920,18 @@ class WASAPIAudioDeviceImpl : public AudioDevice {
     return device_->GetFrameS16LE(audio_data);
   }
   
+  bool GetFrameF32LE(std::vector<uint8_t>* audio_data) override {
+    return device_->GetFrameF32LE(audio_data);
+  }
+  
+  bool GetFrameS32LE(std::vector<uint8_t>* audio_data) override {
+    return device_->GetFrameS32LE(audio_data);
+  }
+  
+  int64_t GetLastFrameTimestampUs() const override {
+    return device_->GetLastTimestampUs();
+  }
+  
   AudioDeviceConfig GetConfig() const override {
     return config_;
   }
@@ -163,10 +946,26 @@ class PulseAudioDeviceImpl : public AudioDevice {
  public:
   explicit PulseAudioDeviceImpl(std::unique_ptr<PulseAudioDevice> device, 
                               const AudioDeviceConfig& config)
-      : device_(std::move(device)), config_(config) {}
+      : device_(std::move(device)), config_(config) {
+    // Report the buffer sizes the server granted
+    config_.buffer_ms = device_->GetConfig().buffer_ms;
+    config_.fragment_ms = device_->GetConfig().fragment_ms;
+  }
   
   bool GetFrameS16LE(std::vector<uint8_t>* audio_data) override {
-    return device_->GetFrameS16LE(audio_data);
+    return device_->GetFrameS16LE(audio_data, &last_timestamp_us_);
+  }
+  
+  bool GetFrameF32LE(std::vector<uint8_t>* audio_data) override {
+    return device_->GetFrameF32LE(audio_data, &last_timestamp_us_);
+  }
+  
+  bool GetFrameS32LE(std::vector<uint8_t>* audio_data) override {
+    return device_->GetFrameS32LE(audio_data, &last_timestamp_us_);
+  }
+  
+  int64_t GetLastFrameTimestampUs() const override {
+    return last_timestamp_us_;
   }
   
   AudioDeviceConfig GetConfig() const override {
@@ -176,6 +975,7 @@ class PulseAudioDeviceImpl : public AudioDevice {
  private:
   std::unique_ptr<PulseAudioDevice> device_;
   AudioDeviceConfig config_;
+  int64_t last_timestamp_us_ = 0;
 };
 #endif
 
@@ -203,6 +1003,12 @@ std::unique_ptr<AudioDevice> AudioDevice::Create(const AudioDeviceConfig& config
     pulse_config.sample_rate = config.sample_rate;
     pulse_config.channels = config.channels;
     pulse_config.buffer_ms = config.buffer_ms;
+    pulse_config.fragment_ms = config.fragment_ms;
+    pulse_config.read_timeout_ms = config.read_timeout_ms;
+    pulse_config.packet_ms = config.packet_ms;
+    pulse_config.float_samples = config.float_samples;
+    pulse_config.resample = config.resample;
+    pulse_config.resample_quality = config.resample_quality;
     
     auto pulse_device = PulseAudioDevice::Create(pulse_config);
     if (pulse_device) {
@@ -216,4 +1022,56 @@ std::unique_ptr<AudioDevice> AudioDevice::Create(const AudioDeviceConfig& config
   return nullptr;
 }
 
+bool AudioDevice::GetFrameF32LE(std::vector<uint8_t>* audio_data) {
+  std::vector<uint8_t> s16;
+  if (!audio_data || !GetFrameS16LE(&s16)) {
+    return false;
+  }
+  size_t samples = s16.size() / sizeof(int16_t);
+  audio_data->resize(samples * sizeof(float));
+  ConvertS16ToF32(reinterpret_cast<const int16_t*>(s16.data()),
+                  reinterpret_cast<float*>(audio_data->data()), samples);
+  return true;
+}
+
+bool AudioDevice::GetFrameS32LE(std::vector<uint8_t>* audio_data) {
+  std::vector<uint8_t> s16;
+  if (!audio_data || !GetFrameS16LE(&s16)) {
+    return false;
+  }
+  size_t samples = s16.size() / sizeof(int16_t);
+  audio_data->resize(samples * sizeof(int32_t));
+  ConvertS16ToS32(reinterpret_cast<const int16_t*>(s16.data()),
+                  reinterpret_cast<int32_t*>(audio_data->data()), samples);
+  return true;
+}
+
+bool AudioDevice::GetPacket(AudioPacket* packet) {
+  if (!packet || !GetFrameS16LE(&packet->data)) {
+    return false;
+  }
+  AudioDeviceConfig config = GetConfig();
+  packet->sample_rate = config.sample_rate;
+  packet->channels = config.channels;
+  
+  // Devices that do not track capture times are stamped on read
+  packet->timestamp_us = GetLastFrameTimestampUs();
+  if (packet->timestamp_us == 0) {
+    packet->timestamp_us = GetCaptureClockUs();
+  }
+  return true;
+}
+
+int64_t AudioDevice::GetLastFrameTimestampUs() const {
+  return 0;  // Not tracked by default
+}
+
+std::unique_ptr<Subscription> AudioDevice::Subscribe(AudioCallback callback,
+                                                     const SubscribeOptions& options) {
+  if (!callback) {
+    return nullptr;
+  }
+  return std::make_unique<AudioSubscription>(this, std::move(callback), options);
+}
+
 }  // namespace media
\ No newline at end of file
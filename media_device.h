@@ -5,6 +5,11 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <functional>
+#include <future>
+#include "capture_clock.h"
+#include "dirty_tile_map.h"
+#include "frame_pool.h"
 
 namespace media {
 
@@ -27,33 +32,183 @@ enum class AudioDeviceType {
 #endif
 };
 
+// YUV conversion matrix for devices that convert from RGB
+enum class ColorMatrix {
+  BT601,
+  BT709,
+};
+
+// YUV quantization range: LIMITED is 16-235 (video), FULL is 0-255
+enum class ColorRange {
+  LIMITED,
+  FULL,
+};
+
+// Pixel layouts a Frame can carry
+enum class PixelFormat {
+  BGRA,  // One plane, 4 bytes per pixel
+  NV12,  // Y plane, then interleaved UV at half resolution
+  I420,  // Y, U and V planes, chroma at half resolution
+};
+
+// Rectangular region of a frame, in pixels
+struct Rect {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
 // Configuration for video device
 struct VideoDeviceConfig {
   VideoDeviceType type;
   bool capture_cursor = true;
   std::string display_id = "";  // Platform default if empty
+  ColorMatrix color_matrix = ColorMatrix::BT601;  // Used for YUV output
+  ColorRange color_range = ColorRange::LIMITED;   // Used for YUV output
+  int worker_threads = 1;  // Threads for frame copy and conversion, 0 for one per core
+  // If set, GetFrame fills Frame::dirty_tiles with the tiles of this many
+  // pixels square that changed since the device's previous capture. NVFBC
+  // tracks changes; other devices mark every tile.
+  int dirty_tile_size = 0;
+  
+  // Capture on a background thread; Get* calls then return the latest
+  // complete frame without blocking, or false before the first one. Call
+  // them from a single consumer thread.
+  bool async_capture = false;
+  int async_fps = 60;  // Target rate of the background thread
+  PixelFormat async_format = PixelFormat::BGRA;  // Only format served when async
   
   // Additional platform-specific options
 #ifndef _WIN32
   bool use_shm = true;  // Only used by X11
+  bool use_damage = false;  // Only used by X11, re-capture changed regions only
+  int shm_segments = 1;  // Only used by X11, more than one pipelines capture
+  bool wait_for_new_frame = false;  // Only used by NVFBC, block until the screen is redrawn
+  int new_frame_timeout_ms = 0;     // Only used by NVFBC, longest wait, 0 for no limit
+  bool skip_unchanged = false;      // Only used by NVFBC, see IsFrameUnchanged
+  // Only used by NVFBC: have the display server render a frame on every
+  // change (push_model) or check for changes every sampling_rate_ms
+  // (0 for 16 ms). With wait_for_new_frame, captures are paced by these.
+  bool push_model = false;
+  int sampling_rate_ms = 0;
+  // Only used by NVFBC: capture one RandR output (e.g. "DP-0") instead of
+  // the whole screen, crop to capture_region within it, and have the GPU
+  // scale to output_width x output_height before copying out. Zero sizes
+  // leave the region whole and unscaled.
+  std::string output_name = "";
+  Rect capture_region;
+  int output_width = 0;
+  int output_height = 0;
 #endif
 };
 
+// Filter quality of in-process audio resampling, cheapest first
+enum class ResampleQuality {
+  FAST,    // 16 taps, passband to 90% of Nyquist
+  MEDIUM,  // 32 taps, passband to 94% of Nyquist
+  HIGH,    // 64 taps, passband to 97% of Nyquist
+};
+
 // Configuration for audio device
 struct AudioDeviceConfig {
   AudioDeviceType type;
   int sample_rate = 44100;
   int channels = 2;
   int buffer_ms = 100;
+  // Linux: audio the server delivers at a time, which bounds capture
+  // latency. 0 delivers a whole buffer_ms at once; set e.g. 5 with a larger
+  // buffer_ms for low latency. GetConfig reports the granted sizes.
+  int fragment_ms = 0;
   std::string device_id = "";  // Platform default if empty
+  int read_timeout_ms = 5000;  // Longest GetFrameS16LE waits for data (Linux)
+  double packet_ms = 0.0;  // Linux: if set, every read is exactly this long (e.g. 2.5-60)
+  bool float_samples = false;  // Linux: capture in float, so GetFrameF32LE needs no conversion
+  // Linux: capture at the source's native rate and convert to sample_rate
+  // in-process, instead of leaving it to the PulseAudio server
+  bool resample = false;
+  ResampleQuality resample_quality = ResampleQuality::MEDIUM;
+};
+
+// Read-only view of a frame owned by the device. NV12 leases have the
+// interleaved UV plane right after height rows of Y, at the same stride.
+struct FrameLease {
+  const uint8_t* data = nullptr;
+  int width = 0;
+  int height = 0;
+  int stride = 0;  // Bytes per row
+  int id = -1;     // Device-specific buffer identifier
+};
+
+// A captured video frame and where its planes live. To capture into your
+// own memory (e.g. an encoder input surface with padded pitches), set
+// format, planes and pitches, with buffer empty, before calling GetFrame.
+// If planes[0] is null, or buffer holds a pooled buffer from an earlier
+// capture, the device attaches a fresh buffer from its frame pool instead,
+// so the same Frame can be passed to GetFrame in a loop.
+struct Frame {
+  PixelFormat format = PixelFormat::BGRA;
+  int width = 0;
+  int height = 0;
+  uint8_t* planes[3] = {nullptr, nullptr, nullptr};
+  int pitches[3] = {0, 0, 0};  // Bytes per row of each plane
+  int64_t timestamp_us = 0;    // Capture time, see GetCaptureClockUs
+  uint64_t sequence = 0;       // Counts frames captured by the device
+  uint32_t missed_frames = 0;  // Frames rendered since the previous frame this
+                               // consumer received but never received, if the
+                               // device can tell
+  DirtyTileMap dirty_tiles;    // Tiles changed since the previous frame this
+                               // consumer received, if dirty_tile_size is set.
+                               // Frames replaced or dropped before delivery
+                               // pass their tiles on to the next one.
+  FrameRef buffer;             // Owns the planes when they came from the pool
+};
+
+// What a subscription does when its sink falls behind
+enum class Backpressure {
+  DROP_OLDEST,  // Queue up to queue_depth items, discarding the oldest
+  BLOCK,        // Queue up to queue_depth items, then stall capture
+  COALESCE,     // Keep only the newest undelivered item
+};
+
+// Options for VideoDevice::Subscribe and AudioDevice::Subscribe
+struct SubscribeOptions {
+  Backpressure backpressure = Backpressure::DROP_OLDEST;
+  int queue_depth = 2;
+  PixelFormat format = PixelFormat::BGRA;  // Video only
+  int fps = 60;  // Video only, capture rate of the subscription
+};
+
+// A packet of captured audio
+struct AudioPacket {
+  std::vector<uint8_t> data;  // Interleaved S16LE samples
+  int sample_rate = 0;
+  int channels = 0;
+  int64_t timestamp_us = 0;   // Capture time of the first sample, see GetCaptureClockUs
 };
 
+// Active push delivery; destroying it stops capture and delivery. It must
+// be destroyed before the device it came from.
+class Subscription {
+ public:
+  virtual ~Subscription() = default;
+};
+
+typedef std::function<void(const Frame&)> FrameCallback;
+typedef std::function<void(const AudioPacket&)> AudioCallback;
+
 // Video device interface
 class VideoDevice {
  public:
   // Create a video device with the specified configuration
   static std::unique_ptr<VideoDevice> Create(const VideoDeviceConfig& config);
 
+  // Create a video device on a background thread and return at once, so
+  // session setup does not hold up the caller. The device comes back
+  // detached; call AttachThread on the thread that captures.
+  static std::future<std::unique_ptr<VideoDevice>> CreateAsync(
+      const VideoDeviceConfig& config);
+
   virtual ~VideoDevice() = default;
 
   // Get dimensions of the captured frame
@@ -66,11 +221,80 @@ class VideoDevice {
   // - Takes a pre-allocated buffer (width * height * 4 bytes)
   virtual bool GetFrameBGRA(uint8_t* bgra_data) = 0;
 
+  // Capture a frame in BGRA format and report the regions that changed
+  // since the previous call. Only the dirty regions are written, so the
+  // same buffer must be passed on every call. Devices without change
+  // tracking report the whole frame as dirty.
+  virtual bool GetDirtyFrameBGRA(uint8_t* bgra_data, std::vector<Rect>* dirty_rects);
+
+  // Lease a BGRA frame straight from the device's capture buffers without
+  // copying it. The view stays valid until ReleaseFrame is called with it;
+  // NVFBC lends its one buffer, so its leases also end at the next capture.
+  // Returns false if the device cannot lend its buffers.
+  virtual bool AcquireFrameBGRA(FrameLease* lease);
+  virtual void ReleaseFrame(const FrameLease& lease);
+
+  // Capture a frame into a recycled, 64-byte aligned buffer from the
+  // device's frame pool. The buffer goes back to the pool when the last
+  // FrameRef to it is dropped, so a steady capture loop does not allocate.
+  virtual bool GetFrameBGRA(FrameRef* frame);
+
+  // Capture a frame in frame->format, into the caller's planes if set or a
+  // pooled buffer otherwise, and fill in its size, timestamp and sequence.
+  // The default supports BGRA only.
+  virtual bool GetFrame(Frame* frame);
+
+  // Same as GetFrame, but first block for up to timeout_ms until the screen
+  // changes (NvFBC grabs, X11 damage events, async captures). Returns false
+  // if nothing changed in time. Devices that cannot wait report so from
+  // CanWaitForFrame and capture at once.
+  virtual bool WaitForFrame(Frame* frame, int timeout_ms);
+  virtual bool CanWaitForFrame() const { return false; }
+
 #ifndef _WIN32
-  // NVFBC-specific formats (only available on Linux with NVIDIA GPUs)
+  // Planar YUV formats (only available on Linux, X11 converts from BGRA)
   virtual bool GetFrameYUV420(std::vector<uint8_t>* data);
   virtual bool GetFrameNV12(std::vector<uint8_t>* data);
+  virtual bool GetFrameYUV420(FrameRef* frame);
+  virtual bool GetFrameNV12(FrameRef* frame);
+  virtual bool AcquireFrameNV12(FrameLease* lease);  // See AcquireFrameBGRA
 #endif
+
+  // Capture on a background thread and call callback with each new frame
+  // from a delivery thread. Devices that can wait for changes are woken by
+  // them, others are polled; either way at most options.fps frames a
+  // second are captured. Frames reference pooled
+  // buffers; keep a copy of the Frame to hold on to one. Do not call other
+  // capture methods while subscribed. Returns null on failure.
+  virtual std::unique_ptr<Subscription> Subscribe(FrameCallback callback,
+                                                  const SubscribeOptions& options);
+
+  // Move thread-bound capture state (the NvFBC context) to or away from
+  // the calling thread. No-ops for devices usable from any thread.
+  virtual void AttachThread() {}
+  virtual void DetachThread() {}
+
+  // Capture time of the frame most recently returned by any capture
+  // method, in GetCaptureClockUs microseconds. 0 before the first frame.
+  virtual int64_t GetLastFrameTimestampUs() const;
+
+  // True if the last capture call failed only because the screen had not
+  // been redrawn since the previous one (skip_unchanged), so there was
+  // nothing to copy. Devices that cannot tell always return false.
+  virtual bool IsFrameUnchanged() const { return false; }
+
+ protected:
+  // Sets the capture timestamp and next sequence number on a frame. A zero
+  // timestamp_us stamps the current time.
+  void StampFrame(Frame* frame, int64_t timestamp_us = 0);
+
+  // Tile size GetFrame reports changes at, 0 if not requested
+  int GetDirtyTileSize() const { return dirty_tile_size_; }
+
+ private:
+  int dirty_tile_size_ = 0;
+  uint64_t frame_sequence_ = 0;
+  int64_t last_timestamp_us_ = 0;
 };
 
 // Audio device interface
@@ -85,8 +309,28 @@ class AudioDevice {
   // Returns true on success, false on failure
   virtual bool GetFrameS16LE(std::vector<uint8_t>* audio_data) = 0;
 
+  // Get a frame of audio data in 32-bit float or signed 32-bit
+  // little-endian format. The defaults convert from GetFrameS16LE.
+  virtual bool GetFrameF32LE(std::vector<uint8_t>* audio_data);
+  virtual bool GetFrameS32LE(std::vector<uint8_t>* audio_data);
+
+  // Same as GetFrameS16LE, also reporting the format and the capture time
+  // of the first sample
+  virtual bool GetPacket(AudioPacket* packet);
+
+  // Capture time of the first sample most recently returned by any read,
+  // in GetCaptureClockUs microseconds. On Linux this is corrected for the
+  // stream's latency. 0 if the device does not track capture times.
+  virtual int64_t GetLastFrameTimestampUs() const;
+
   // Get the current audio configuration
   virtual AudioDeviceConfig GetConfig() const = 0;
+
+  // Capture on a background thread and call callback with each packet from
+  // a delivery thread. Do not call GetFrameS16LE while subscribed. Returns
+  // null on failure.
+  virtual std::unique_ptr<Subscription> Subscribe(AudioCallback callback,
+                                                  const SubscribeOptions& options);
 };
 
 }  // namespace media
@@ -0,0 +1,163 @@
+// Tests of DeliveryQueue's backpressure policies. Each test runs in its own
+// process, named on the command line.
+
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "delivery_queue.h"
+
+namespace media {
+namespace testing {
+namespace {
+
+#define EXPECT(condition)                                              \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": expected "        \
+                << #condition << std::endl;                            \
+      return false;                                                    \
+    }                                                                  \
+  } while (0)
+
+// Sink that holds up the first frame until released, so the frames pushed
+// meanwhile pile up, and keeps what it is given
+class HeldSink {
+ public:
+  void Deliver(const Frame& frame) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frames_.push_back(frame);
+    changed_.notify_all();
+    changed_.wait(lock, [this] { return released_; });
+  }
+
+  // Waits until the sink holds the first frame
+  void WaitForFirst() { WaitFor(1); }
+
+  // Lets frames through and waits until count have arrived
+  std::vector<Frame> Release(size_t count) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      released_ = true;
+    }
+    changed_.notify_all();
+    WaitFor(count);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_;
+  }
+
+ private:
+  void WaitFor(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this, count] { return frames_.size() >= count; });
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<Frame> frames_;
+  bool released_ = false;
+};
+
+// A 4 x 1 tile frame with one dirty tile
+Frame TileFrame(uint64_t sequence, int tile) {
+  Frame frame;
+  frame.sequence = sequence;
+  frame.dirty_tiles.Reset(64, 16, 16);
+  frame.dirty_tiles.MarkRect(tile * 16, 0, 16, 16);
+  return frame;
+}
+
+// Frames dropped for a newer one pass their dirty tiles and missed frames
+// on to the frame delivered after them
+bool TestDropOldestKeepsTiles() {
+  HeldSink sink;
+  DeliveryQueue<Frame> queue([&sink](const Frame& frame) { sink.Deliver(frame); },
+                             Backpressure::DROP_OLDEST, 2);
+  Frame frame = TileFrame(1, 0);
+  EXPECT(queue.Push(&frame));
+  sink.WaitForFirst();
+
+  frame = TileFrame(2, 1);
+  EXPECT(queue.Push(&frame));
+  frame = TileFrame(3, 2);
+  EXPECT(queue.Push(&frame));
+  frame = TileFrame(4, 3);
+  frame.missed_frames = 2;
+  EXPECT(!queue.Push(&frame));  // Drops 2 in favour of 3
+
+  std::vector<Frame> delivered = sink.Release(3);
+  EXPECT(delivered.size() == 3);
+  EXPECT(delivered[1].sequence == 3);
+  EXPECT(delivered[1].missed_frames == 1);
+  EXPECT(delivered[1].dirty_tiles.GetDirtyCount() == 2);
+  EXPECT(delivered[1].dirty_tiles.IsDirty(1, 0));
+  EXPECT(delivered[1].dirty_tiles.IsDirty(2, 0));
+  EXPECT(delivered[2].sequence == 4);
+  EXPECT(delivered[2].missed_frames == 2);
+  EXPECT(delivered[2].dirty_tiles.GetDirtyCount() == 1);
+  return true;
+}
+
+// Coalescing folds each replaced frame into the one replacing it
+bool TestCoalesceKeepsTiles() {
+  HeldSink sink;
+  DeliveryQueue<Frame> queue([&sink](const Frame& frame) { sink.Deliver(frame); },
+                             Backpressure::COALESCE, 1);
+  Frame frame = TileFrame(1, 0);
+  EXPECT(queue.Push(&frame));
+  sink.WaitForFirst();
+
+  frame = TileFrame(2, 1);
+  EXPECT(queue.Push(&frame));
+  frame = TileFrame(3, 2);
+  EXPECT(!queue.Push(&frame));
+  frame = TileFrame(4, 1);
+  EXPECT(!queue.Push(&frame));
+
+  std::vector<Frame> delivered = sink.Release(2);
+  EXPECT(delivered.size() == 2);
+  EXPECT(delivered[1].sequence == 4);
+  EXPECT(delivered[1].missed_frames == 2);
+  EXPECT(delivered[1].dirty_tiles.GetDirtyCount() == 2);
+  EXPECT(delivered[1].dirty_tiles.IsDirty(1, 0));
+  EXPECT(delivered[1].dirty_tiles.IsDirty(2, 0));
+
+  // A frame of another size cannot be merged tile by tile
+  DirtyTileMap tiles;
+  tiles.Reset(64, 16, 16);
+  DirtyTileMap other;
+  other.Reset(32, 16, 16);
+  other.MarkRect(0, 0, 1, 1);
+  tiles.Merge(other);
+  EXPECT(tiles.GetDirtyCount() == 4);
+  return true;
+}
+
+struct Test {
+  const char* name;
+  bool (*run)();
+};
+
+const Test kTests[] = {
+    {"drop_oldest_keeps_tiles", TestDropOldestKeepsTiles},
+    {"coalesce_keeps_tiles", TestCoalesceKeepsTiles},
+};
+
+}  // namespace
+}  // namespace testing
+}  // namespace media
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <test>" << std::endl;
+    return 2;
+  }
+  for (const media::testing::Test& test : media::testing::kTests) {
+    if (strcmp(test.name, argv[1]) == 0) {
+      return test.run() ? 0 : 1;
+    }
+  }
+  std::cerr << "Unknown test: " << argv[1] << std::endl;
+  return 2;
+}
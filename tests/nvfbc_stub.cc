@@ -0,0 +1,274 @@
+// Stand-in for NVIDIA's libnvidia-fbc.so.1, so the NvFBC backend can be
+// tested without an NVIDIA driver or X server. It simulates a display
+// server rendering numbered frames into system memory; see NvFBCStubState.
+
+#include "nvfbc_stub.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace media {
+namespace testing {
+
+NvFBCStubState& GetNvFBCStubState() {
+  static NvFBCStubState state;
+  return state;
+}
+
+namespace {
+
+struct StubOutput {
+  uint32_t id;
+  const char* name;
+  int index;  // Left or right half of the screen
+};
+
+const StubOutput kOutputs[] = {{100, "DP-0", 0}, {200, "DP-2", 1}};
+
+// Buffers handed to the backend by ToSysSetUp
+std::vector<uint8_t> g_frame;
+std::vector<uint8_t> g_diff_map;
+NVFBC_BUFFER_FORMAT g_format = NVFBC_BUFFER_FORMAT_BGRA;
+int g_last_grabbed = -1;
+
+// Thread each handle's context is current on, if any
+std::mutex g_context_mutex;
+std::thread::id g_context_owner[kStubMaxHandles];
+
+std::thread::id& ContextOwner(NVFBC_SESSION_HANDLE session) {
+  return g_context_owner[session % kStubMaxHandles];
+}
+
+bool OwnsContext(NVFBC_SESSION_HANDLE session) {
+  std::lock_guard<std::mutex> lock(g_context_mutex);
+  return ContextOwner(session) == std::this_thread::get_id();
+}
+
+NVFBC_BOX OutputBox(const StubOutput& output) {
+  const NvFBCStubState& state = GetNvFBCStubState();
+  uint32_t width = static_cast<uint32_t>(state.screen_width / 2);
+  return NVFBC_BOX{width * output.index, 0, width,
+                   static_cast<uint32_t>(state.screen_height)};
+}
+
+// Size of captured frames, after tracking, cropping and scaling
+void SessionFrameSize(int* width, int* height) {
+  const NvFBCStubState& state = GetNvFBCStubState();
+  const NVFBC_CREATE_CAPTURE_SESSION_PARAMS& params = state.session_params;
+  *width = state.screen_width;
+  *height = state.screen_height;
+  if (params.eTrackingType == NVFBC_TRACKING_OUTPUT) {
+    for (const StubOutput& output : kOutputs) {
+      if (output.id == params.dwOutputId) {
+        *width = static_cast<int>(OutputBox(output).w);
+        *height = static_cast<int>(OutputBox(output).h);
+      }
+    }
+  }
+  if (params.captureBox.w != 0) {
+    *width = static_cast<int>(params.captureBox.w);
+    *height = static_cast<int>(params.captureBox.h);
+  }
+  if (params.frameSize.w != 0) {
+    *width = static_cast<int>(params.frameSize.w);
+    *height = static_cast<int>(params.frameSize.h);
+    if (params.bRoundFrameSize) {
+      *width = (*width + 3) & ~3;
+      *height = (*height + 1) & ~1;
+    }
+  }
+}
+
+size_t FrameBytes(NVFBC_BUFFER_FORMAT format, int width, int height) {
+  size_t pixels = static_cast<size_t>(width) * height;
+  switch (format) {
+    case NVFBC_BUFFER_FORMAT_NV12: return pixels * 3 / 2;
+    case NVFBC_BUFFER_FORMAT_RGB: return pixels * 3;
+    case NVFBC_BUFFER_FORMAT_YUV444P: return pixels * 3;
+    default: return pixels * 4;
+  }
+}
+
+const char* GetLastErrorStr(const NVFBC_SESSION_HANDLE) {
+  return "stub error";
+}
+
+NVFBCSTATUS CreateHandle(NVFBC_SESSION_HANDLE* session, NVFBC_CREATE_HANDLE_PARAMS*) {
+  NvFBCStubState& state = GetNvFBCStubState();
+  int creating = ++state.creating;
+  int most = state.max_creating.load();
+  while (creating > most && !state.max_creating.compare_exchange_weak(most, creating)) {
+  }
+
+  // Hold the handle open a moment, as the driver does while it connects,
+  // so overlapping creations would be seen
+  int handle = ++state.handles;
+  const char* display = getenv("DISPLAY");
+  usleep(2000);
+  snprintf(state.handle_display[handle % kStubMaxHandles], kStubDisplayLength, "%s",
+           display ? display : "");
+  *session = static_cast<NVFBC_SESSION_HANDLE>(handle);
+  {
+    std::lock_guard<std::mutex> lock(g_context_mutex);
+    ContextOwner(*session) = std::this_thread::get_id();
+  }
+  --state.creating;
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS DestroyHandle(NVFBC_SESSION_HANDLE, NVFBC_DESTROY_HANDLE_PARAMS*) {
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS GetStatus(NVFBC_SESSION_HANDLE, NVFBC_GET_STATUS_PARAMS* params) {
+  const NvFBCStubState& state = GetNvFBCStubState();
+  params->bIsCapturePossible = NVFBC_TRUE;
+  params->bCanCreateNow = NVFBC_TRUE;
+  params->bXRandRAvailable = NVFBC_TRUE;
+  params->screenSize.w = static_cast<uint32_t>(state.screen_width);
+  params->screenSize.h = static_cast<uint32_t>(state.screen_height);
+  params->dwOutputNum = 2;
+  for (const StubOutput& output : kOutputs) {
+    params->outputs[output.index].dwId = output.id;
+    snprintf(params->outputs[output.index].name, sizeof(params->outputs[output.index].name),
+             "%s", output.name);
+    params->outputs[output.index].trackedBox = OutputBox(output);
+  }
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS CreateCaptureSession(NVFBC_SESSION_HANDLE,
+                                 NVFBC_CREATE_CAPTURE_SESSION_PARAMS* params) {
+  GetNvFBCStubState().session_params = *params;
+  g_last_grabbed = -1;
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS DestroyCaptureSession(NVFBC_SESSION_HANDLE,
+                                  NVFBC_DESTROY_CAPTURE_SESSION_PARAMS*) {
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS ToSysSetUp(NVFBC_SESSION_HANDLE, NVFBC_TOSYS_SETUP_PARAMS* params) {
+  NvFBCStubState& state = GetNvFBCStubState();
+  ++state.setup_calls;
+
+  int width = 0;
+  int height = 0;
+  SessionFrameSize(&width, &height);
+  g_format = params->eBufferFormat;
+  // The new buffer starts out holding the current frame
+  g_frame.assign(FrameBytes(g_format, width, height),
+                 static_cast<uint8_t>(state.rendered_frames));
+  *params->ppBuffer = g_frame.data();
+
+  if (params->bWithDiffMap) {
+    int scale = std::max<int>(params->dwDiffMapScalingFactor, 1);
+    params->diffMapSize.w = static_cast<uint32_t>((width + scale - 1) / scale);
+    params->diffMapSize.h = static_cast<uint32_t>((height + scale - 1) / scale);
+    g_diff_map.assign(params->diffMapSize.w * params->diffMapSize.h, 0);
+    *params->ppDiffMap = g_diff_map.data();
+  }
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS ToSysGrabFrame(NVFBC_SESSION_HANDLE session,
+                           NVFBC_TOSYS_GRAB_FRAME_PARAMS* params) {
+  if (!OwnsContext(session)) {
+    return NVFBC_ERR_CONTEXT;
+  }
+  NvFBCStubState& state = GetNvFBCStubState();
+  ++state.grab_calls;
+  state.last_grab_flags = params->dwFlags;
+  state.last_grab_timeout_ms = params->dwTimeoutMs;
+
+  // Without NOWAIT, sleep until the next frame is rendered or the timeout
+  // passes; on timeout the last frame is returned again
+  bool fresh = state.rendered_frames != g_last_grabbed;
+  if (!fresh && !(params->dwFlags & NVFBC_TOSYS_GRAB_FLAGS_NOWAIT)) {
+    uint32_t delay = static_cast<uint32_t>(state.render_delay_ms);
+    if (delay > 0 && (params->dwTimeoutMs == 0 || params->dwTimeoutMs >= delay)) {
+      usleep(delay * 1000);
+      ++state.rendered_frames;
+      fresh = true;
+    } else {
+      usleep(params->dwTimeoutMs * 1000);
+    }
+  }
+
+  // Frames are filled with their number; the diff map flags one block
+  uint32_t missed = 0;
+  std::fill(g_diff_map.begin(), g_diff_map.end(), 0);
+  if (fresh) {
+    if (g_last_grabbed >= 0) {
+      missed = static_cast<uint32_t>(state.rendered_frames - g_last_grabbed - 1);
+    }
+    std::fill(g_frame.begin(), g_frame.end(), static_cast<uint8_t>(state.rendered_frames));
+    if (!g_diff_map.empty()) {
+      g_diff_map[state.rendered_frames % g_diff_map.size()] = 1;
+    }
+  }
+  g_last_grabbed = state.rendered_frames;
+
+  if (params->pFrameGrabInfo) {
+    NVFBC_FRAME_GRAB_INFO* info = params->pFrameGrabInfo;
+    int width = 0;
+    int height = 0;
+    SessionFrameSize(&width, &height);
+    memset(info, 0, sizeof(*info));
+    info->dwWidth = static_cast<uint32_t>(width);
+    info->dwHeight = static_cast<uint32_t>(height);
+    info->dwByteSize = static_cast<uint32_t>(g_frame.size());
+    info->dwCurrentFrame = static_cast<uint32_t>(state.rendered_frames);
+    info->bIsNewFrame = fresh ? NVFBC_TRUE : NVFBC_FALSE;
+    info->ulTimestampUs = 1000000 + 16667ull * state.rendered_frames;
+    info->dwMissedFrames = missed;
+  }
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS BindContext(NVFBC_SESSION_HANDLE session, NVFBC_BIND_CONTEXT_PARAMS*) {
+  std::lock_guard<std::mutex> lock(g_context_mutex);
+  std::thread::id& owner = ContextOwner(session);
+  if (owner != std::thread::id() && owner != std::this_thread::get_id()) {
+    return NVFBC_ERR_CONTEXT;
+  }
+  owner = std::this_thread::get_id();
+  return NVFBC_SUCCESS;
+}
+
+NVFBCSTATUS ReleaseContext(NVFBC_SESSION_HANDLE session, NVFBC_RELEASE_CONTEXT_PARAMS*) {
+  std::lock_guard<std::mutex> lock(g_context_mutex);
+  std::thread::id& owner = ContextOwner(session);
+  if (owner != std::this_thread::get_id()) {
+    return NVFBC_ERR_CONTEXT;
+  }
+  owner = std::thread::id();
+  return NVFBC_SUCCESS;
+}
+
+}  // namespace
+}  // namespace testing
+}  // namespace media
+
+extern "C" NVFBCSTATUS NvFBCCreateInstance(NVFBC_API_FUNCTION_LIST* functions) {
+  using namespace media::testing;
+  ++GetNvFBCStubState().instance_calls;
+  functions->nvFBCGetLastErrorStr = GetLastErrorStr;
+  functions->nvFBCCreateHandle = CreateHandle;
+  functions->nvFBCDestroyHandle = DestroyHandle;
+  functions->nvFBCGetStatus = GetStatus;
+  functions->nvFBCCreateCaptureSession = CreateCaptureSession;
+  functions->nvFBCDestroyCaptureSession = DestroyCaptureSession;
+  functions->nvFBCToSysSetUp = ToSysSetUp;
+  functions->nvFBCToSysGrabFrame = ToSysGrabFrame;
+  functions->nvFBCBindContext = BindContext;
+  functions->nvFBCReleaseContext = ReleaseContext;
+  return NVFBC_SUCCESS;
+}
@@ -0,0 +1,60 @@
+#ifndef MEDIA_TESTS_NVFBC_STUB_H_
+#define MEDIA_TESTS_NVFBC_STUB_H_
+
+#include <atomic>
+#include <cstdint>
+#include "nvfbc/nvfbc.h"
+
+namespace media {
+namespace testing {
+
+// Longest DISPLAY value recorded per handle
+constexpr int kStubDisplayLength = 32;
+
+// Handles whose DISPLAY is recorded
+constexpr int kStubMaxHandles = 64;
+
+// State of the stub libnvidia-fbc.so.1. Tests set the screen and drive the
+// simulated display server through it, and read back what the backend
+// asked NvFBC for. Only handle creation may run on several threads.
+//
+// As with the driver, a handle's context is current on the thread that
+// created it until released, may be bound by one thread at a time, and
+// grabs fail on any other thread.
+struct NvFBCStubState {
+  // Screen the stub reports, split into two outputs side by side:
+  // "DP-0" (id 100) on the left half and "DP-2" (id 200) on the right
+  int screen_width = 64;
+  int screen_height = 32;
+
+  // Frames the display server has rendered; bump it to simulate a redraw
+  int rendered_frames = 0;
+
+  // If set, a grab waiting for a new frame gets one after this long
+  // instead of timing out
+  int render_delay_ms = 0;
+
+  // Calls made by the backend. NvFBCCreateInstance is called once per load
+  // of the library.
+  std::atomic<int> instance_calls{0};
+  int setup_calls = 0;
+  int grab_calls = 0;
+  uint32_t last_grab_flags = 0;
+  uint32_t last_grab_timeout_ms = 0;
+  NVFBC_CREATE_CAPTURE_SESSION_PARAMS session_params = {};
+
+  // DISPLAY as each handle saw it while being created, indexed by handle,
+  // and the most creations that ever overlapped
+  std::atomic<int> handles{0};
+  std::atomic<int> creating{0};
+  std::atomic<int> max_creating{0};
+  char handle_display[kStubMaxHandles][kStubDisplayLength] = {};
+};
+
+// The stub's state, shared by every session
+NvFBCStubState& GetNvFBCStubState();
+
+}  // namespace testing
+}  // namespace media
+
+#endif  // MEDIA_TESTS_NVFBC_STUB_H_
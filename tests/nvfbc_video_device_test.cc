@@ -0,0 +1,403 @@
+// Tests of the NvFBC backend against the stub libnvidia-fbc.so.1. Each
+// test runs in its own process, named on the command line, since NvFBC is
+// loaded once per process.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "nvfbc_stub.h"
+#include "nvfbc_video_device.h"
+
+namespace media {
+namespace testing {
+namespace {
+
+#define EXPECT(condition)                                              \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": expected "        \
+                << #condition << std::endl;                            \
+      return false;                                                    \
+    }                                                                  \
+  } while (0)
+
+// The system memory buffer is set up once per format, not once per grab
+bool TestSetUpOncePerFormat() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  auto device = NVFBCVideoDevice::Create(NVFBCVideoDeviceConfig());
+  EXPECT(device);
+
+  std::vector<uint8_t> data;
+  for (int i = 0; i < 100; ++i) {
+    EXPECT(device->GetFrameBGRA(&data));
+  }
+  EXPECT(stub.setup_calls == 1);
+  EXPECT(stub.grab_calls == 100);
+
+  FrameRef frame;
+  EXPECT(device->GetFrameNV12(&data));
+  EXPECT(device->GetFrameNV12(&data));
+  EXPECT(device->GetFrame(NVFBC_BUFFER_FORMAT_NV12, &frame));
+  EXPECT(stub.setup_calls == 2);
+  EXPECT(frame->size() == static_cast<size_t>(stub.screen_width * stub.screen_height * 3 / 2));
+
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(stub.setup_calls == 3);
+  return true;
+}
+
+// NEW_FRAME grabs report whether the frame is new and how many were
+// missed, and skip_unchanged fails grabs that found nothing new
+bool TestNewFrameReporting() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  NVFBCVideoDeviceConfig config;
+  config.grab_mode = NVFBCGrabMode::NEW_FRAME;
+  config.grab_timeout_ms = 20;
+  config.skip_unchanged = true;
+  auto device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+
+  FrameRef frame;
+  EXPECT(device->GetFrame(NVFBC_BUFFER_FORMAT_BGRA, &frame));
+  NVFBCFrameInfo first = device->GetLastFrameInfo();
+  EXPECT(first.is_new_frame);
+  EXPECT(!first.skipped);
+  EXPECT(stub.last_grab_flags == NVFBC_TOSYS_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY);
+  EXPECT(stub.last_grab_timeout_ms == 20);
+
+  // Nothing rendered since: the grab times out and is skipped
+  EXPECT(!device->GetFrame(NVFBC_BUFFER_FORMAT_BGRA, &frame));
+  EXPECT(!device->GetLastFrameInfo().is_new_frame);
+  EXPECT(device->GetLastFrameInfo().skipped);
+
+  // Four rendered, only the last grabbed
+  stub.rendered_frames += 4;
+  EXPECT(device->GetFrame(NVFBC_BUFFER_FORMAT_BGRA, &frame));
+  NVFBCFrameInfo latest = device->GetLastFrameInfo();
+  EXPECT(latest.is_new_frame);
+  EXPECT(!latest.skipped);
+  EXPECT(latest.missed_frames == 3);
+  EXPECT(latest.frame_number == 4);
+  EXPECT(latest.timestamp_us > first.timestamp_us);
+  EXPECT(frame->data()[0] == 4);
+  return true;
+}
+
+// Outputs are tracked by name, cropped by capture_box and scaled to
+// frame_size, and the device reports the size that results
+bool TestCaptureRegion() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  NVFBCVideoDeviceConfig config;
+  config.output_name = "DP-2";
+  auto device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+  EXPECT(stub.session_params.eTrackingType == NVFBC_TRACKING_OUTPUT);
+  EXPECT(stub.session_params.dwOutputId == 200);
+  EXPECT(device->GetWidth() == 32);
+  EXPECT(device->GetHeight() == 32);
+  std::vector<NVFBCOutput> outputs = device->GetOutputs();
+  EXPECT(outputs.size() == 2);
+  EXPECT(outputs[1].name == "DP-2");
+  EXPECT(outputs[1].tracked_box.x == 32);
+
+  config.capture_box = NVFBC_BOX{8, 4, 16, 8};
+  device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+  EXPECT(stub.session_params.captureBox.x == 8);
+  EXPECT(stub.session_params.captureBox.w == 16);
+  EXPECT(device->GetWidth() == 16);
+  EXPECT(device->GetHeight() == 8);
+
+  // Scaled sizes round up to a multiple of 4 x 2
+  config.frame_size = NVFBC_SIZE{30, 15};
+  device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+  EXPECT(stub.session_params.bRoundFrameSize == NVFBC_TRUE);
+  EXPECT(device->GetWidth() == 32);
+  EXPECT(device->GetHeight() == 16);
+  std::vector<uint8_t> data;
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(data.size() == 32 * 16 * 4);
+
+  // Unknown outputs and boxes outside the output are refused
+  config.output_name = "HDMI-0";
+  EXPECT(!NVFBCVideoDevice::Create(config));
+  config.output_name = "DP-0";
+  config.capture_box = NVFBC_BOX{24, 0, 16, 8};
+  EXPECT(!NVFBCVideoDevice::Create(config));
+  return true;
+}
+
+// BorrowFrame lends out NvFBC's own buffer, and the copying calls built
+// on it return the same bytes
+bool TestBorrowFrame() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  auto device = NVFBCVideoDevice::Create(NVFBCVideoDeviceConfig());
+  EXPECT(device);
+
+  stub.rendered_frames = 7;
+  NVFBCFrameView view;
+  EXPECT(device->BorrowFrame(NVFBC_BUFFER_FORMAT_BGRA, &view));
+  const size_t bytes = static_cast<size_t>(stub.screen_width * stub.screen_height * 4);
+  EXPECT(view.data != nullptr);
+  EXPECT(view.size == bytes);
+  EXPECT(view.width == stub.screen_width);
+  EXPECT(view.height == stub.screen_height);
+  std::vector<uint8_t> borrowed(view.data, view.data + view.size);
+  EXPECT(borrowed == std::vector<uint8_t>(bytes, 7));
+
+  // The same frame again, copied out
+  std::vector<uint8_t> data;
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(data == borrowed);
+  FrameRef frame;
+  EXPECT(device->GetFrame(NVFBC_BUFFER_FORMAT_BGRA, &frame));
+  EXPECT(std::vector<uint8_t>(frame->data(), frame->data() + frame->size()) == borrowed);
+
+  // Other formats are lent at their own size
+  EXPECT(device->BorrowFrame(NVFBC_BUFFER_FORMAT_NV12, &view));
+  EXPECT(view.size == bytes * 3 / 8);
+  EXPECT(view.data[0] == 7);
+  EXPECT(stub.setup_calls == 2);
+  return true;
+}
+
+// With diff_map_block_size set, dirty tiles come from NvFBC's diff map,
+// relative to the previous grab, except on the first grab in a format
+bool TestDiffMap() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  NVFBCVideoDeviceConfig config;
+  config.diff_map_block_size = 16;
+  auto device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+
+  // Nothing to compare the first grab against: all of the 4 x 2 tiles
+  std::vector<uint8_t> data;
+  DirtyTileMap tiles;
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(!device->GetDirtyTiles(16, &tiles));
+  EXPECT(tiles.GetColumns() == 4);
+  EXPECT(tiles.GetRows() == 2);
+  EXPECT(tiles.GetDirtyCount() == 8);
+
+  // The stub flags block rendered_frames % 8 of each new frame
+  stub.rendered_frames = 1;
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(device->GetDirtyTiles(16, &tiles));
+  EXPECT(tiles.GetDirtyCount() == 1);
+  EXPECT(tiles.IsDirty(1, 0));
+
+  // Tiles larger than the blocks cover several of them
+  stub.rendered_frames = 6;
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(device->GetDirtyTiles(32, &tiles));
+  EXPECT(tiles.GetColumns() == 2);
+  EXPECT(tiles.GetRows() == 1);
+  EXPECT(tiles.GetDirtyCount() == 1);
+  EXPECT(tiles.IsDirty(1, 0));
+
+  // Grabbing the same frame again changes nothing
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(device->GetDirtyTiles(16, &tiles));
+  EXPECT(tiles.GetDirtyCount() == 0);
+
+  // Neither can the first grab after a format change
+  EXPECT(device->GetFrameNV12(&data));
+  EXPECT(!device->GetDirtyTiles(16, &tiles));
+  EXPECT(tiles.GetDirtyCount() == 8);
+  return true;
+}
+
+// Milliseconds since start
+int64_t ElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// push_model and sampling_rate_ms reach the session, and WaitForFrame
+// sleeps until a frame is rendered or the timeout passes
+bool TestWaitForFrame() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  NVFBCVideoDeviceConfig config;
+  config.sampling_rate_ms = 33;
+  auto device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+  EXPECT(stub.session_params.bPushModel == NVFBC_FALSE);
+  EXPECT(stub.session_params.dwSamplingRateMs == 33);
+
+  config.push_model = true;
+  device = NVFBCVideoDevice::Create(config);
+  EXPECT(device);
+  EXPECT(stub.session_params.bPushModel == NVFBC_TRUE);
+
+  // A frame not yet seen returns at once
+  FrameRef frame;
+  EXPECT(device->WaitForFrame(NVFBC_BUFFER_FORMAT_BGRA, 1000, &frame));
+  EXPECT(stub.last_grab_flags == NVFBC_TOSYS_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY);
+
+  // Otherwise it blocks until the next one is rendered
+  stub.render_delay_ms = 30;
+  auto start = std::chrono::steady_clock::now();
+  EXPECT(device->WaitForFrame(NVFBC_BUFFER_FORMAT_BGRA, 1000, &frame));
+  EXPECT(ElapsedMs(start) >= 30);
+  EXPECT(stub.last_grab_timeout_ms == 1000);
+  EXPECT(device->GetLastFrameInfo().is_new_frame);
+  EXPECT(frame->data()[0] == stub.rendered_frames);
+
+  // Or gives up after the timeout, with nothing copied
+  stub.render_delay_ms = 0;
+  start = std::chrono::steady_clock::now();
+  EXPECT(!device->WaitForFrame(NVFBC_BUFFER_FORMAT_BGRA, 20, &frame));
+  EXPECT(ElapsedMs(start) >= 20);
+  EXPECT(device->GetLastFrameInfo().skipped);
+  return true;
+}
+
+// Devices created at once from several threads each connect to their own
+// display, one at a time, and DISPLAY is left as it was
+bool TestConcurrentCreation() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  setenv("DISPLAY", ":9", 1);
+
+  const int kDevices = 8;
+  std::vector<std::unique_ptr<NVFBCVideoDevice>> devices(kDevices);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kDevices; ++i) {
+    threads.emplace_back([&devices, i] {
+      NVFBCVideoDeviceConfig config;
+      config.display_id = i % 2 ? ":1" : "";  // Empty means the inherited DISPLAY
+      devices[i] = NVFBCVideoDevice::Create(config);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (const auto& device : devices) {
+    EXPECT(device);
+  }
+  EXPECT(stub.handles == kDevices);
+  EXPECT(stub.max_creating == 1);
+  int inherited = 0;
+  int other = 0;
+  for (int handle = 1; handle <= kDevices; ++handle) {
+    inherited += strcmp(stub.handle_display[handle], ":9") == 0;
+    other += strcmp(stub.handle_display[handle], ":1") == 0;
+  }
+  EXPECT(inherited == kDevices / 2);
+  EXPECT(other == kDevices / 2);
+  EXPECT(strcmp(getenv("DISPLAY"), ":9") == 0);
+  return true;
+}
+
+// DISPLAY is read afresh at each creation: a change made by the
+// application between two devices is used, and kept, by the second
+bool TestDisplayChange() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  NVFBCVideoDeviceConfig inherit;
+  NVFBCVideoDeviceConfig other;
+  other.display_id = ":1";
+
+  setenv("DISPLAY", ":9", 1);
+  auto first = NVFBCVideoDevice::Create(other);
+  EXPECT(first);
+  EXPECT(strcmp(stub.handle_display[1], ":1") == 0);
+  EXPECT(strcmp(getenv("DISPLAY"), ":9") == 0);
+
+  setenv("DISPLAY", ":7", 1);
+  auto second = NVFBCVideoDevice::Create(other);
+  EXPECT(second);
+  EXPECT(strcmp(stub.handle_display[2], ":1") == 0);
+  EXPECT(strcmp(getenv("DISPLAY"), ":7") == 0);
+
+  auto third = NVFBCVideoDevice::Create(inherit);
+  EXPECT(third);
+  EXPECT(strcmp(stub.handle_display[3], ":7") == 0);
+  EXPECT(strcmp(getenv("DISPLAY"), ":7") == 0);
+
+  // Unset stays unset, and an empty display_id then means ":0"
+  unsetenv("DISPLAY");
+  auto fourth = NVFBCVideoDevice::Create(other);
+  EXPECT(fourth);
+  EXPECT(getenv("DISPLAY") == nullptr);
+  auto fifth = NVFBCVideoDevice::Create(inherit);
+  EXPECT(fifth);
+  EXPECT(strcmp(stub.handle_display[5], ":0") == 0);
+  EXPECT(getenv("DISPLAY") == nullptr);
+  return true;
+}
+
+// Preload resolves the library once for the whole process, and
+// CreateAsync hands back a device whose context any thread can bind
+bool TestCreateAsync() {
+  NvFBCStubState& stub = GetNvFBCStubState();
+  EXPECT(NVFBCVideoDevice::Preload());
+  EXPECT(NVFBCVideoDevice::Preload());
+  EXPECT(stub.instance_calls == 1);
+
+  std::unique_ptr<NVFBCVideoDevice> device =
+      NVFBCVideoDevice::CreateAsync(NVFBCVideoDeviceConfig()).get();
+  EXPECT(device);
+  EXPECT(stub.instance_calls == 1);
+  EXPECT(device->GetWidth() == stub.screen_width);
+
+  // Created on another thread and released there, so it grabs here once
+  // bound, and not before
+  std::vector<uint8_t> data;
+  EXPECT(!device->GetFrameBGRA(&data));
+  EXPECT(device->BindContext());
+  EXPECT(device->GetFrameBGRA(&data));
+  EXPECT(data.size() == static_cast<size_t>(stub.screen_width * stub.screen_height * 4));
+
+  // Bound here, so no other thread can take it until released
+  bool bound_elsewhere = true;
+  std::thread([&device, &bound_elsewhere] {
+    bound_elsewhere = device->BindContext();
+  }).join();
+  EXPECT(!bound_elsewhere);
+  EXPECT(device->ReleaseContext());
+
+  // Another device reuses the loaded library
+  EXPECT(NVFBCVideoDevice::CreateAsync(NVFBCVideoDeviceConfig()).get());
+  EXPECT(stub.instance_calls == 1);
+  return true;
+}
+
+struct Test {
+  const char* name;
+  bool (*run)();
+};
+
+const Test kTests[] = {
+    {"setup_once_per_format", TestSetUpOncePerFormat},
+    {"new_frame_reporting", TestNewFrameReporting},
+    {"capture_region", TestCaptureRegion},
+    {"borrow_frame", TestBorrowFrame},
+    {"diff_map", TestDiffMap},
+    {"wait_for_frame", TestWaitForFrame},
+    {"concurrent_creation", TestConcurrentCreation},
+    {"display_change", TestDisplayChange},
+    {"create_async", TestCreateAsync},
+};
+
+}  // namespace
+}  // namespace testing
+}  // namespace media
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <test>" << std::endl;
+    return 2;
+  }
+  for (const media::testing::Test& test : media::testing::kTests) {
+    if (strcmp(test.name, argv[1]) == 0) {
+      return test.run() ? 0 : 1;
+    }
+  }
+  std::cerr << "Unknown test: " << argv[1] << std::endl;
+  return 2;
+}
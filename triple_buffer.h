@@ -0,0 +1,56 @@
+#ifndef MEDIA_TRIPLE_BUFFER_H_
+#define MEDIA_TRIPLE_BUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace media {
+
+// Lock-free single producer, single consumer hand-off of the latest value.
+// The producer fills the back slot and publishes it; the consumer picks up
+// the most recently published slot. Neither side ever waits on the other,
+// and values published faster than they are read are simply replaced.
+template <typename T>
+class TripleBuffer {
+ public:
+  // Producer: slot to fill before the next Publish
+  T& back() { return slots_[back_]; }
+
+  // Producer: makes the back slot the latest value
+  void Publish() {
+    back_ = middle_.exchange(back_ | kFreshBit, std::memory_order_acq_rel) & kIndexMask;
+  }
+
+  // Producer: true if the value last published has not been picked up yet,
+  // so the next Publish replaces it. The consumer may pick it up at any
+  // moment, so true can be stale; false cannot.
+  bool HasUnread() const {
+    return middle_.load(std::memory_order_acquire) & kFreshBit;
+  }
+
+  // Consumer: switches to the latest published value, if there is one
+  // newer than the current front. Returns true if the front changed.
+  bool Update() {
+    if (!(middle_.load(std::memory_order_relaxed) & kFreshBit)) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+    return true;
+  }
+
+  // Consumer: value as of the last successful Update
+  T& front() { return slots_[front_]; }
+
+ private:
+  static constexpr uint8_t kIndexMask = 0x3;
+  static constexpr uint8_t kFreshBit = 0x4;
+
+  T slots_[3];
+  uint8_t back_ = 0;   // Owned by the producer
+  uint8_t front_ = 1;  // Owned by the consumer
+  std::atomic<uint8_t> middle_{2};  // Slot index plus kFreshBit when unread
+};
+
+}  // namespace media
+
+#endif  // MEDIA_TRIPLE_BUFFER_H_
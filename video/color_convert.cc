@@ -0,0 +1,489 @@
+#include "color_convert.h"
+
+#include <algorithm>
+#include "cpu_features.h"
+
+#ifdef MEDIA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace media {
+
+namespace {
+
+// Fixed point (Q14) coefficients in BGRA byte order
+struct YUVCoefficients {
+  int16_t y[3];
+  int16_t u[3];
+  int16_t v[3];
+  int y_offset;
+};
+
+// Rows are [BT.601, BT.709] x [limited, full]
+const YUVCoefficients kCoefficients[2][2] = {
+  {
+    {{1604, 8260, 4207}, {7196, -4768, -2428}, {-1170, -6026, 7196}, 16},
+    {{1868, 9617, 4899}, {8192, -5427, -2765}, {-1332, -6860, 8192}, 0},
+  },
+  {
+    {{1016, 10064, 2991}, {7196, -5547, -1649}, {-660, -6536, 7196}, 16},
+    {{1183, 11718, 3483}, {8192, -6315, -1877}, {-751, -7441, 8192}, 0},
+  },
+};
+
+const YUVCoefficients& GetCoefficients(ColorMatrix matrix, ColorRange range) {
+  return kCoefficients[matrix == ColorMatrix::BT709 ? 1 : 0]
+                      [range == ColorRange::FULL ? 1 : 0];
+}
+
+// Rounding bias for luma and chroma. Chroma is computed from the sum of
+// two vertically averaged pixels, hence the extra bit of shift.
+inline int LumaBias(const YUVCoefficients& c) {
+  return (c.y_offset << 14) + (1 << 13);
+}
+
+constexpr int kChromaBias = (128 << 15) + (1 << 14);
+
+inline uint8_t Clamp255(int value) {
+  return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+}
+
+//
+// Scalar kernels, also used for the row tails of the vector kernels. The
+// arithmetic matches the vector kernels bit for bit.
+//
+
+void RowToY_C(const uint8_t* bgra, uint8_t* y, int width,
+              const YUVCoefficients& c) {
+  const int bias = LumaBias(c);
+  for (int x = 0; x < width; ++x) {
+    const uint8_t* p = bgra + x * 4;
+    y[x] = Clamp255((c.y[0] * p[0] + c.y[1] * p[1] + c.y[2] * p[2] + bias) >> 14);
+  }
+}
+
+template <bool kInterleaved>
+void RowToUV_C(const uint8_t* row0, const uint8_t* row1,
+               uint8_t* u, uint8_t* v, int width,
+               const YUVCoefficients& c) {
+  for (int x = 0; x < width; x += 2) {
+    int x1 = std::min(x + 1, width - 1);
+    int sum[3];
+    for (int ch = 0; ch < 3; ++ch) {
+      int a = (row0[x * 4 + ch] + row1[x * 4 + ch] + 1) >> 1;
+      int b = (row0[x1 * 4 + ch] + row1[x1 * 4 + ch] + 1) >> 1;
+      sum[ch] = a + b;
+    }
+    uint8_t u_value = Clamp255(
+        (c.u[0] * sum[0] + c.u[1] * sum[1] + c.u[2] * sum[2] + kChromaBias) >> 15);
+    uint8_t v_value = Clamp255(
+        (c.v[0] * sum[0] + c.v[1] * sum[1] + c.v[2] * sum[2] + kChromaBias) >> 15);
+    if (kInterleaved) {
+      u[x] = u_value;
+      u[x + 1] = v_value;
+    } else {
+      u[x / 2] = u_value;
+      v[x / 2] = v_value;
+    }
+  }
+}
+
+#ifdef MEDIA_X86_KERNELS
+
+//
+// SSSE3 kernels, 16 pixels per iteration
+//
+
+__attribute__((target("ssse3")))
+inline __m128i CoefficientsSSSE3(const int16_t* coef) {
+  return _mm_setr_epi16(coef[0], coef[1], coef[2], 0,
+                        coef[0], coef[1], coef[2], 0);
+}
+
+// Four BGRA pixels to four 32-bit luma values
+__attribute__((target("ssse3")))
+inline __m128i LumaSSSE3(const uint8_t* bgra, __m128i coef, __m128i bias) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgra));
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+  return _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), bias), 14);
+}
+
+// Four BGRA pixels from each row to two 2x2 sums per channel (16-bit)
+__attribute__((target("ssse3")))
+inline __m128i PairSumsSSSE3(const uint8_t* row0, const uint8_t* row1) {
+  const __m128i pair_shuffle = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7,
+                                             8, 12, 9, 13, 10, 14, 11, 15);
+  __m128i avg = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0)),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1)));
+  return _mm_maddubs_epi16(_mm_shuffle_epi8(avg, pair_shuffle), _mm_set1_epi8(1));
+}
+
+// Two sets of pair sums to four 32-bit chroma values
+__attribute__((target("ssse3")))
+inline __m128i ChromaSSSE3(__m128i sums0, __m128i sums1, __m128i coef) {
+  __m128i value = _mm_hadd_epi32(_mm_madd_epi16(sums0, coef),
+                                 _mm_madd_epi16(sums1, coef));
+  return _mm_srai_epi32(_mm_add_epi32(value, _mm_set1_epi32(kChromaBias)), 15);
+}
+
+__attribute__((target("ssse3")))
+void RowToY_SSSE3(const uint8_t* bgra, uint8_t* y, int width,
+                  const YUVCoefficients& c) {
+  const __m128i coef = CoefficientsSSSE3(c.y);
+  const __m128i bias = _mm_set1_epi32(LumaBias(c));
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8_t* p = bgra + x * 4;
+    __m128i y0 = _mm_packs_epi32(LumaSSSE3(p, coef, bias),
+                                 LumaSSSE3(p + 16, coef, bias));
+    __m128i y1 = _mm_packs_epi32(LumaSSSE3(p + 32, coef, bias),
+                                 LumaSSSE3(p + 48, coef, bias));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), _mm_packus_epi16(y0, y1));
+  }
+  RowToY_C(bgra + x * 4, y + x, width - x, c);
+}
+
+template <bool kInterleaved>
+__attribute__((target("ssse3")))
+void RowToUV_SSSE3(const uint8_t* row0, const uint8_t* row1,
+                   uint8_t* u, uint8_t* v, int width,
+                   const YUVCoefficients& c) {
+  const __m128i u_coef = CoefficientsSSSE3(c.u);
+  const __m128i v_coef = CoefficientsSSSE3(c.v);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8_t* p0 = row0 + x * 4;
+    const uint8_t* p1 = row1 + x * 4;
+    __m128i s0 = PairSumsSSSE3(p0, p1);
+    __m128i s1 = PairSumsSSSE3(p0 + 16, p1 + 16);
+    __m128i s2 = PairSumsSSSE3(p0 + 32, p1 + 32);
+    __m128i s3 = PairSumsSSSE3(p0 + 48, p1 + 48);
+    __m128i u16 = _mm_packs_epi32(ChromaSSSE3(s0, s1, u_coef),
+                                  ChromaSSSE3(s2, s3, u_coef));
+    __m128i v16 = _mm_packs_epi32(ChromaSSSE3(s0, s1, v_coef),
+                                  ChromaSSSE3(s2, s3, v_coef));
+    // Eight U values followed by eight V values
+    __m128i uv = _mm_packus_epi16(u16, v16);
+    if (kInterleaved) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x),
+                       _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 8)));
+    } else {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), uv);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_srli_si128(uv, 8));
+    }
+  }
+  if (kInterleaved) {
+    RowToUV_C<true>(row0 + x * 4, row1 + x * 4, u + x, nullptr, width - x, c);
+  } else {
+    RowToUV_C<false>(row0 + x * 4, row1 + x * 4, u + x / 2, v + x / 2, width - x, c);
+  }
+}
+
+//
+// AVX2 kernels, 16 pixels per iteration for luma and 32 for chroma. Packing
+// works per 128-bit lane, so results are permuted back into pixel order.
+//
+
+__attribute__((target("avx2")))
+inline __m256i CoefficientsAVX2(const int16_t* coef) {
+  return _mm256_setr_epi16(coef[0], coef[1], coef[2], 0,
+                           coef[0], coef[1], coef[2], 0,
+                           coef[0], coef[1], coef[2], 0,
+                           coef[0], coef[1], coef[2], 0);
+}
+
+// Eight BGRA pixels to eight 32-bit luma values
+__attribute__((target("avx2")))
+inline __m256i LumaAVX2(const uint8_t* bgra, __m256i coef, __m256i bias) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bgra));
+  __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+  __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+  return _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), bias), 14);
+}
+
+// Eight BGRA pixels from each row to four 2x2 sums per channel (16-bit)
+__attribute__((target("avx2")))
+inline __m256i PairSumsAVX2(const uint8_t* row0, const uint8_t* row1) {
+  const __m256i pair_shuffle = _mm256_setr_epi8(
+      0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15,
+      0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+  __m256i avg = _mm256_avg_epu8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1)));
+  return _mm256_maddubs_epi16(_mm256_shuffle_epi8(avg, pair_shuffle),
+                              _mm256_set1_epi8(1));
+}
+
+// Two sets of pair sums to eight 32-bit chroma values in order
+__attribute__((target("avx2")))
+inline __m256i ChromaAVX2(__m256i sums0, __m256i sums1, __m256i coef) {
+  const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+  __m256i value = _mm256_hadd_epi32(_mm256_madd_epi16(sums0, coef),
+                                    _mm256_madd_epi16(sums1, coef));
+  value = _mm256_srai_epi32(_mm256_add_epi32(value, _mm256_set1_epi32(kChromaBias)), 15);
+  return _mm256_permutevar8x32_epi32(value, order);
+}
+
+// Two registers of eight 32-bit values to sixteen ordered 16-bit values
+__attribute__((target("avx2")))
+inline __m256i PackOrderedAVX2(__m256i lo, __m256i hi) {
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+__attribute__((target("avx2")))
+void RowToY_AVX2(const uint8_t* bgra, uint8_t* y, int width,
+                 const YUVCoefficients& c) {
+  const __m256i coef = CoefficientsAVX2(c.y);
+  const __m256i bias = _mm256_set1_epi32(LumaBias(c));
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const uint8_t* p = bgra + x * 4;
+    __m256i y16 = PackOrderedAVX2(LumaAVX2(p, coef, bias),
+                                  LumaAVX2(p + 32, coef, bias));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x),
+                     _mm_packus_epi16(_mm256_castsi256_si128(y16),
+                                      _mm256_extracti128_si256(y16, 1)));
+  }
+  RowToY_C(bgra + x * 4, y + x, width - x, c);
+}
+
+template <bool kInterleaved>
+__attribute__((target("avx2")))
+void RowToUV_AVX2(const uint8_t* row0, const uint8_t* row1,
+                  uint8_t* u, uint8_t* v, int width,
+                  const YUVCoefficients& c) {
+  const __m256i u_coef = CoefficientsAVX2(c.u);
+  const __m256i v_coef = CoefficientsAVX2(c.v);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    const uint8_t* p0 = row0 + x * 4;
+    const uint8_t* p1 = row1 + x * 4;
+    __m256i s0 = PairSumsAVX2(p0, p1);
+    __m256i s1 = PairSumsAVX2(p0 + 32, p1 + 32);
+    __m256i s2 = PairSumsAVX2(p0 + 64, p1 + 64);
+    __m256i s3 = PairSumsAVX2(p0 + 96, p1 + 96);
+    __m256i u16 = PackOrderedAVX2(ChromaAVX2(s0, s1, u_coef),
+                                  ChromaAVX2(s2, s3, u_coef));
+    __m256i v16 = PackOrderedAVX2(ChromaAVX2(s0, s1, v_coef),
+                                  ChromaAVX2(s2, s3, v_coef));
+    // Sixteen U values in the low lane, sixteen V values in the high lane
+    __m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(u16, v16), 0xD8);
+    __m128i u8 = _mm256_castsi256_si128(uv);
+    __m128i v8 = _mm256_extracti128_si256(uv, 1);
+    if (kInterleaved) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_unpacklo_epi8(u8, v8));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x + 16), _mm_unpackhi_epi8(u8, v8));
+    } else {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x / 2), u8);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x / 2), v8);
+    }
+  }
+  if (kInterleaved) {
+    RowToUV_C<true>(row0 + x * 4, row1 + x * 4, u + x, nullptr, width - x, c);
+  } else {
+    RowToUV_C<false>(row0 + x * 4, row1 + x * 4, u + x / 2, v + x / 2, width - x, c);
+  }
+}
+
+//
+// AVX-512 kernels, 16 pixels per iteration for luma and 32 for chroma.
+// There is no 512-bit horizontal add, so a two-register permute pairs up
+// the partial sums, in pixel order, before adding them.
+//
+
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i CoefficientsAVX512(const int16_t* coef) {
+  return _mm512_broadcast_i32x4(_mm_setr_epi16(coef[0], coef[1], coef[2], 0,
+                                               coef[0], coef[1], coef[2], 0));
+}
+
+// Adds adjacent 32-bit values of a then b, giving sixteen sums in order of
+// index: a[0] + a[1], a[2] + a[3], ..., b[14] + b[15], permuted by order
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i PairAddAVX512(__m512i a, __m512i b, __m512i order) {
+  const __m512i one = _mm512_set1_epi32(1);
+  return _mm512_add_epi32(_mm512_permutex2var_epi32(a, order, b),
+                          _mm512_permutex2var_epi32(a, _mm512_add_epi32(order, one), b));
+}
+
+// Sixteen 32-bit values clamped to bytes
+__attribute__((target("avx512f,avx512bw")))
+inline __m128i ClampToBytesAVX512(__m512i value) {
+  return _mm512_cvtusepi32_epi8(_mm512_max_epi32(value, _mm512_setzero_si512()));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void RowToY_AVX512(const uint8_t* bgra, uint8_t* y, int width,
+                   const YUVCoefficients& c) {
+  // Unpacking leaves pixels 0-1 of each lane in the low half and 2-3 in
+  // the high half; pick each pixel's two partial sums from the right one
+  const __m512i order = _mm512_setr_epi32(0, 2, 16, 18, 4, 6, 20, 22,
+                                          8, 10, 24, 26, 12, 14, 28, 30);
+  const __m512i coef = CoefficientsAVX512(c.y);
+  const __m512i bias = _mm512_set1_epi32(LumaBias(c));
+  const __m512i zero = _mm512_setzero_si512();
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m512i px = _mm512_loadu_si512(bgra + x * 4);
+    __m512i lo = _mm512_madd_epi16(_mm512_unpacklo_epi8(px, zero), coef);
+    __m512i hi = _mm512_madd_epi16(_mm512_unpackhi_epi8(px, zero), coef);
+    __m512i luma = _mm512_srai_epi32(_mm512_add_epi32(PairAddAVX512(lo, hi, order), bias), 14);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), ClampToBytesAVX512(luma));
+  }
+  RowToY_C(bgra + x * 4, y + x, width - x, c);
+}
+
+// Sixteen BGRA pixels from each row to eight 2x2 sums per channel (16-bit)
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i PairSumsAVX512(const uint8_t* row0, const uint8_t* row1) {
+  const __m512i pair_shuffle = _mm512_broadcast_i32x4(
+      _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15));
+  __m512i avg = _mm512_avg_epu8(_mm512_loadu_si512(row0), _mm512_loadu_si512(row1));
+  return _mm512_maddubs_epi16(_mm512_shuffle_epi8(avg, pair_shuffle),
+                              _mm512_set1_epi8(1));
+}
+
+template <bool kInterleaved>
+__attribute__((target("avx512f,avx512bw")))
+void RowToUV_AVX512(const uint8_t* row0, const uint8_t* row1,
+                    uint8_t* u, uint8_t* v, int width,
+                    const YUVCoefficients& c) {
+  // Pair sums are already in pixel order, so partial sums simply pair up
+  const __m512i order = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14,
+                                          16, 18, 20, 22, 24, 26, 28, 30);
+  const __m512i u_coef = CoefficientsAVX512(c.u);
+  const __m512i v_coef = CoefficientsAVX512(c.v);
+  const __m512i bias = _mm512_set1_epi32(kChromaBias);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m512i s0 = PairSumsAVX512(row0 + x * 4, row1 + x * 4);
+    __m512i s1 = PairSumsAVX512(row0 + x * 4 + 64, row1 + x * 4 + 64);
+    __m512i u32 = PairAddAVX512(_mm512_madd_epi16(s0, u_coef),
+                                _mm512_madd_epi16(s1, u_coef), order);
+    __m512i v32 = PairAddAVX512(_mm512_madd_epi16(s0, v_coef),
+                                _mm512_madd_epi16(s1, v_coef), order);
+    __m128i u8 = ClampToBytesAVX512(_mm512_srai_epi32(_mm512_add_epi32(u32, bias), 15));
+    __m128i v8 = ClampToBytesAVX512(_mm512_srai_epi32(_mm512_add_epi32(v32, bias), 15));
+    if (kInterleaved) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_unpacklo_epi8(u8, v8));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x + 16), _mm_unpackhi_epi8(u8, v8));
+    } else {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x / 2), u8);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x / 2), v8);
+    }
+  }
+  if (kInterleaved) {
+    RowToUV_C<true>(row0 + x * 4, row1 + x * 4, u + x, nullptr, width - x, c);
+  } else {
+    RowToUV_C<false>(row0 + x * 4, row1 + x * 4, u + x / 2, v + x / 2, width - x, c);
+  }
+}
+
+#endif  // MEDIA_X86_KERNELS
+
+typedef void (*RowToYFunc)(const uint8_t*, uint8_t*, int, const YUVCoefficients&);
+typedef void (*RowToUVFunc)(const uint8_t*, const uint8_t*, uint8_t*, uint8_t*, int,
+                            const YUVCoefficients&);
+
+struct ColorKernels {
+  RowToYFunc row_to_y;
+  RowToUVFunc row_to_uv;              // Planar U and V
+  RowToUVFunc row_to_uv_interleaved;  // NV12 UV, the V pointer is unused
+};
+
+ColorKernels SelectKernels(CpuLevel level) {
+#ifdef MEDIA_X86_KERNELS
+  if (level >= CpuLevel::AVX512) {
+    return {RowToY_AVX512, RowToUV_AVX512<false>, RowToUV_AVX512<true>};
+  }
+  if (level >= CpuLevel::AVX2) {
+    return {RowToY_AVX2, RowToUV_AVX2<false>, RowToUV_AVX2<true>};
+  }
+  if (level >= CpuLevel::SSSE3) {
+    return {RowToY_SSSE3, RowToUV_SSSE3<false>, RowToUV_SSSE3<true>};
+  }
+#endif
+  return {RowToY_C, RowToUV_C<false>, RowToUV_C<true>};
+}
+
+const ColorKernels& GetKernels() {
+  static const ColorKernels kernels = SelectKernels(GetCpuLevel());
+  return kernels;
+}
+
+}  // namespace
+
+size_t YUV420FrameSize(int width, int height) {
+  size_t chroma_width = (width + 1) / 2;
+  size_t chroma_height = (height + 1) / 2;
+  return static_cast<size_t>(width) * height + 2 * chroma_width * chroma_height;
+}
+
+void ConvertBGRAToNV12(const uint8_t* bgra, int bgra_stride,
+                       int width, int height,
+                       uint8_t* y, int y_stride,
+                       uint8_t* uv, int uv_stride,
+                       ColorMatrix matrix, ColorRange range,
+                       WorkerPool* pool) {
+  const YUVCoefficients& c = GetCoefficients(matrix, range);
+  const ColorKernels& kernels = GetKernels();
+
+  // Work on row pairs so the source rows are still cached for chroma
+  auto convert_band = [&](int first_row, int end_row) {
+    for (int row = first_row; row < end_row; row += 2) {
+      const uint8_t* row0 = bgra + static_cast<size_t>(row) * bgra_stride;
+      const uint8_t* row1 = row + 1 < height ? row0 + bgra_stride : row0;
+      kernels.row_to_y(row0, y + static_cast<size_t>(row) * y_stride, width, c);
+      if (row + 1 < height) {
+        kernels.row_to_y(row1, y + static_cast<size_t>(row + 1) * y_stride, width, c);
+      }
+      kernels.row_to_uv_interleaved(row0, row1,
+                                    uv + static_cast<size_t>(row / 2) * uv_stride,
+                                    nullptr, width, c);
+    }
+  };
+
+  if (pool) {
+    pool->ForEachBand(height, 2, convert_band);
+  } else {
+    convert_band(0, height);
+  }
+}
+
+void ConvertBGRAToI420(const uint8_t* bgra, int bgra_stride,
+                       int width, int height,
+                       uint8_t* y, int y_stride,
+                       uint8_t* u, int u_stride,
+                       uint8_t* v, int v_stride,
+                       ColorMatrix matrix, ColorRange range,
+                       WorkerPool* pool) {
+  const YUVCoefficients& c = GetCoefficients(matrix, range);
+  const ColorKernels& kernels = GetKernels();
+
+  // Work on row pairs so the source rows are still cached for chroma
+  auto convert_band = [&](int first_row, int end_row) {
+    for (int row = first_row; row < end_row; row += 2) {
+      const uint8_t* row0 = bgra + static_cast<size_t>(row) * bgra_stride;
+      const uint8_t* row1 = row + 1 < height ? row0 + bgra_stride : row0;
+      kernels.row_to_y(row0, y + static_cast<size_t>(row) * y_stride, width, c);
+      if (row + 1 < height) {
+        kernels.row_to_y(row1, y + static_cast<size_t>(row + 1) * y_stride, width, c);
+      }
+      kernels.row_to_uv(row0, row1,
+                        u + static_cast<size_t>(row / 2) * u_stride,
+                        v + static_cast<size_t>(row / 2) * v_stride,
+                        width, c);
+    }
+  };
+
+  if (pool) {
+    pool->ForEachBand(height, 2, convert_band);
+  } else {
+    convert_band(0, height);
+  }
+}
+
+}  // namespace media
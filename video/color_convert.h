@@ -0,0 +1,34 @@
+#ifndef MEDIA_COLOR_CONVERT_H_
+#define MEDIA_COLOR_CONVERT_H_
+
+#include <cstdint>
+#include "media_device.h"
+#include "worker_pool.h"
+
+namespace media {
+
+// Size in bytes of a tightly packed 4:2:0 frame (NV12 or I420)
+size_t YUV420FrameSize(int width, int height);
+
+// Converts a BGRA image to NV12: a full resolution Y plane followed by an
+// interleaved UV plane at half resolution. Odd sizes round the chroma up.
+// With a pool, row bands are converted in parallel.
+void ConvertBGRAToNV12(const uint8_t* bgra, int bgra_stride,
+                       int width, int height,
+                       uint8_t* y, int y_stride,
+                       uint8_t* uv, int uv_stride,
+                       ColorMatrix matrix, ColorRange range,
+                       WorkerPool* pool = nullptr);
+
+// Converts a BGRA image to I420: Y, U and V planes, chroma at half resolution
+void ConvertBGRAToI420(const uint8_t* bgra, int bgra_stride,
+                       int width, int height,
+                       uint8_t* y, int y_stride,
+                       uint8_t* u, int u_stride,
+                       uint8_t* v, int v_stride,
+                       ColorMatrix matrix, ColorRange range,
+                       WorkerPool* pool = nullptr);
+
+}  // namespace media
+
+#endif  // MEDIA_COLOR_CONVERT_H_
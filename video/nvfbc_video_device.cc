@@ -1,8 +1,14 @@
 #include "nvfbc_video_device.h"
 #include <dlfcn.h>
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <future>
 #include <iostream>
-#include <X11/Xlib.h>
+#include <mutex>
+#include "capture_clock.h"
+#include "pixel_kernels.h"
 
 namespace media {
 
@@ -11,6 +17,45 @@ namespace media {
 
 namespace {
 
+// Serializes the DISPLAY switch around nvFBCCreateHandle, see CreateHandle
+std::mutex g_displayMutex;
+
+// Span of recent grabs whose smallest timestamp offset is used, see GrabFrame
+constexpr int64_t kTimestampOffsetWindowUs = 2000000;
+
+// Loads the NvFBC library and its function list once per process; every
+// session shares them. The library stays loaded for the life of the
+// process. Returns null if loading failed, which is not retried.
+const NVFBC_API_FUNCTION_LIST* LoadNvFBC() {
+    static const NVFBC_API_FUNCTION_LIST* functions = []() -> const NVFBC_API_FUNCTION_LIST* {
+        void* library = dlopen(LIB_NVFBC_NAME, RTLD_NOW);
+        if (library == nullptr) {
+            std::cerr << "Unable to open '" << LIB_NVFBC_NAME << "': " << dlerror() << std::endl;
+            return nullptr;
+        }
+
+        auto createInstance = reinterpret_cast<PNVFBCCREATEINSTANCE>(
+            dlsym(library, "NvFBCCreateInstance"));
+        if (createInstance == nullptr) {
+            std::cerr << "Unable to resolve symbol 'NvFBCCreateInstance': " << dlerror() << std::endl;
+            dlclose(library);
+            return nullptr;
+        }
+
+        static NVFBC_API_FUNCTION_LIST functionList;
+        memset(&functionList, 0, sizeof(functionList));
+        functionList.dwVersion = NVFBC_VERSION;
+        NVFBCSTATUS fbcStatus = createInstance(&functionList);
+        if (fbcStatus != NVFBC_SUCCESS) {
+            std::cerr << "Unable to create NvFBC instance (status: " << fbcStatus << ")" << std::endl;
+            dlclose(library);
+            return nullptr;
+        }
+        return &functionList;
+    }();
+    return functions;
+}
+
 // Private implementation of the NVFBCVideoDevice interface
 class NVFBCVideoDeviceImpl : public NVFBCVideoDevice {
 public:
@@ -26,18 +71,50 @@ public:
     bool GetFrameRGB(std::vector<uint8_t>* data) override;
     bool GetFrameNV12(std::vector<uint8_t>* data) override;
     bool GetFrameYUV444P(std::vector<uint8_t>* data) override;
+    bool GetFrame(NVFBC_BUFFER_FORMAT format, FrameRef* frame) override;
+    bool WaitForFrame(NVFBC_BUFFER_FORMAT format, int timeoutMs, FrameRef* frame) override;
+    bool BorrowFrame(NVFBC_BUFFER_FORMAT format, NVFBCFrameView* view) override;
+    NVFBCFrameInfo GetLastFrameInfo() const override;
+    bool GetDirtyTiles(int tileSize, DirtyTileMap* tiles) const override;
+    std::vector<NVFBCOutput> GetOutputs() const override;
+    bool BindContext() override;
+    bool ReleaseContext() override;
 
 private:
-    // Initialize X11 display and get resolution
-    bool InitializeX11Display();
+    // Pick the X display to capture, given the current DISPLAY (null if
+    // unset). Call with g_displayMutex held.
+    void ResolveDisplayName(const char* inherited);
     
     // Initialize NVFBC library
     bool InitializeNvFBC();
     
+    // Create the NvFBC handle on this device's X display
+    bool CreateHandle();
+    
     // Create and setup capture session
     bool CreateCaptureSession();
     
-    // Grab a frame with specified format
+    // Fill in the tracking, crop and scaling options from the config and
+    // the outputs NvFBC reported, and set the frame size they produce
+    bool SetUpCaptureRegion(const NVFBC_GET_STATUS_PARAMS& status,
+                            NVFBC_CREATE_CAPTURE_SESSION_PARAMS* params);
+    
+    // Points NvFBC's system memory buffer at a format, unless it already is
+    bool SetUpToSys(NVFBC_BUFFER_FORMAT format);
+    
+    // Grab a frame with specified format into NvFBC's system memory buffer,
+    // waiting as the config says
+    const unsigned char* GrabFrame(NVFBC_BUFFER_FORMAT format);
+    
+    // Grab with explicit NVFBC_TOSYS_GRAB_FLAGS and timeout. If
+    // skipUnchanged is set, grabs that return no new frame fail.
+    const unsigned char* GrabFrame(NVFBC_BUFFER_FORMAT format, uint32_t flags,
+                                   uint32_t timeoutMs, bool skipUnchanged);
+    
+    // Copy a grabbed frame into a buffer from the frame pool
+    bool CopyToPool(NVFBC_BUFFER_FORMAT format, const unsigned char* captured, FrameRef* frame);
+    
+    // Grab a frame with specified format and copy it out
     bool GrabFrame(NVFBC_BUFFER_FORMAT format, std::vector<uint8_t>* data);
     
     // Calculate frame size based on format
@@ -46,42 +123,63 @@ private:
     // Cleanup functions
     void DestroyCaptureSession();
     void DestroyHandle();
-    void CloseX11Display();
 
     // NVFBC related members
     NVFBC_SESSION_HANDLE m_session = 0;
-    void* m_libNVFBC = nullptr;
-    NVFBC_API_FUNCTION_LIST* m_pFn = nullptr;
-    void (*NvFBCCreateInstance_ptr)(NVFBC_API_FUNCTION_LIST*) = nullptr;
+    const NVFBC_API_FUNCTION_LIST* m_pFn = nullptr;  // Shared, see LoadNvFBC
     
-    // X11 display related members
-    Display* m_display = nullptr;
-    int m_screen = 0;
+    // X display NvFBC captures, as passed to it in DISPLAY
+    std::string m_displayName;
     
     // Config settings
     NVFBCVideoDeviceConfig m_config;
     
-    // Display dimensions
+    // Captured frame dimensions, 0 until the session is set up
     int m_width = 0;
     int m_height = 0;
+    
+    // RandR outputs reported when the session was created
+    std::vector<NVFBCOutput> m_outputs;
+    
+    // Recycled buffers handed out by GetFrame
+    FramePool m_framePool;
+    
+    // System memory buffer set up by SetUpToSys. NvFBC keeps the address of
+    // m_sysBuffer and updates it when it re-allocates, e.g. on a mode change.
+    void* m_sysBuffer = nullptr;
+    NVFBC_BUFFER_FORMAT m_sysFormat = NVFBC_BUFFER_FORMAT_BGRA;
+    bool m_sysSetUp = false;
+    
+    // Diff map set up alongside m_sysBuffer, one byte per block of
+    // m_config.diff_map_block_size pixels, m_diffMapSize blocks as NvFBC
+    // allocated it. m_diffMapValid is set once a grab has compared against
+    // a previous one in the same format.
+    void* m_diffMap = nullptr;
+    NVFBC_SIZE m_diffMapSize = {0, 0};
+    bool m_sysWithDiffMap = false;
+    bool m_sysFirstGrab = false;
+    bool m_diffMapValid = false;
+    
+    // The last grab, and the offsets from NvFBC's timestamps to the capture
+    // clock seen in the last kTimestampOffsetWindowUs as (grab time, offset),
+    // increasing in both so the front is the window's minimum
+    NVFBCFrameInfo m_lastFrameInfo;
+    std::deque<std::pair<int64_t, int64_t>> m_timestampOffsets;
 };
 
 NVFBCVideoDeviceImpl::NVFBCVideoDeviceImpl(const NVFBCVideoDeviceConfig& config)
     : m_config(config) {
-    if (!InitializeX11Display()) {
-        std::cerr << "X11 display initialization failed." << std::endl;
-        return;
-    }
-
     if (!InitializeNvFBC()) {
         std::cerr << "NVFBC Initialization failed." << std::endl;
-        CloseX11Display();
         return;
     }
 
+    // Leaves the frame size at 0 on failure, which Create checks
     if (!CreateCaptureSession()) {
         std::cerr << "NVFBC Create Capture Session failed." << std::endl;
-        CloseX11Display();
+        DestroyHandle();
+        m_width = 0;
+        m_height = 0;
         return;
     }
 }
@@ -89,46 +187,15 @@ NVFBCVideoDeviceImpl::NVFBCVideoDeviceImpl(const NVFBCVideoDeviceConfig& config)
 NVFBCVideoDeviceImpl::~NVFBCVideoDeviceImpl() {
     DestroyCaptureSession();
     DestroyHandle();
-
-    if (m_libNVFBC) {
-        dlclose(m_libNVFBC);
-        m_libNVFBC = nullptr;
-    }
-
-    CloseX11Display();
-}
-
-bool NVFBCVideoDeviceImpl::InitializeX11Display() {
-
-    // Open X For entire process
-    if (m_config.display_id.empty()) {
-        setenv("DISPLAY", ":0", 1);  // Use a default display like ":0"
-    } else {
-        setenv("DISPLAY", m_config.display_id.c_str(), 1);
-    }
-
-    // Open X display
-    m_display = XOpenDisplay(m_config.display_id.empty() ? nullptr : m_config.display_id.c_str());
-    if (!m_display) {
-        std::cerr << "Failed to open X display: " << (m_config.display_id.empty() ? ":0" : m_config.display_id) << std::endl;
-        return false;
-    }
-
-    // Get default screen
-    m_screen = DefaultScreen(m_display);
-    
-    // Get screen dimensions
-    m_width = DisplayWidth(m_display, m_screen);
-    m_height = DisplayHeight(m_display, m_screen);
-    
-    std::cout << "Initialized X display with resolution: " << m_width << "x" << m_height << std::endl;
-    return true;
 }
 
-void NVFBCVideoDeviceImpl::CloseX11Display() {
-    if (m_display) {
-        XCloseDisplay(m_display);
-        m_display = nullptr;
+void NVFBCVideoDeviceImpl::ResolveDisplayName(const char* inherited) {
+    // An empty display_id means the inherited DISPLAY, else ":0". NvFBC
+    // opens the display itself and reports its size, so there is no need
+    // for a connection of our own.
+    m_displayName = m_config.display_id;
+    if (m_displayName.empty()) {
+        m_displayName = inherited && *inherited ? inherited : ":0";
     }
 }
 
@@ -164,27 +231,135 @@ bool NVFBCVideoDeviceImpl::GetFrameYUV444P(std::vector<uint8_t>* data) {
     return GrabFrame(NVFBC_BUFFER_FORMAT_YUV444P, data);
 }
 
-bool NVFBCVideoDeviceImpl::InitializeNvFBC() {
-    m_libNVFBC = dlopen(LIB_NVFBC_NAME, RTLD_NOW);
-    if (m_libNVFBC == nullptr) {
-        std::cerr << "Unable to open '" << LIB_NVFBC_NAME << "': " << dlerror() << std::endl;
+bool NVFBCVideoDeviceImpl::GetFrame(NVFBC_BUFFER_FORMAT format, FrameRef* frame) {
+    if (!frame) {
+        std::cerr << "Invalid parameters for frame capture" << std::endl;
+        return false;
+    }
+
+    const unsigned char* captured = GrabFrame(format);
+    return captured && CopyToPool(format, captured, frame);
+}
+
+bool NVFBCVideoDeviceImpl::WaitForFrame(NVFBC_BUFFER_FORMAT format, int timeoutMs, FrameRef* frame) {
+    if (!frame) {
+        std::cerr << "Invalid parameters for frame capture" << std::endl;
+        return false;
+    }
+
+    // Sleeps in the driver until a frame this session has not seen is
+    // ready; on timeout NvFBC hands back the old one, which is skipped
+    const unsigned char* captured = GrabFrame(format, NVFBC_TOSYS_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY,
+                                              static_cast<uint32_t>(std::max(timeoutMs, 0)), true);
+    return captured && CopyToPool(format, captured, frame);
+}
+
+bool NVFBCVideoDeviceImpl::BorrowFrame(NVFBC_BUFFER_FORMAT format, NVFBCFrameView* view) {
+    if (!view) {
+        std::cerr << "Invalid parameters for frame capture" << std::endl;
+        return false;
+    }
+
+    const unsigned char* captured = GrabFrame(format);
+    if (!captured) {
+        return false;
+    }
+
+    view->data = captured;
+    view->size = CalculateFrameSize(format);
+    view->width = m_width;
+    view->height = m_height;
+    return true;
+}
+
+bool NVFBCVideoDeviceImpl::CopyToPool(NVFBC_BUFFER_FORMAT format, const unsigned char* captured,
+                                      FrameRef* frame) {
+    size_t frameSize = CalculateFrameSize(format);
+    *frame = m_framePool.Acquire(frameSize);
+    if (!*frame) {
         return false;
     }
+    CopyRows(captured, frameSize, (*frame)->data(), frameSize, frameSize, 1);
+
+    return true;
+}
 
-    NvFBCCreateInstance_ptr = reinterpret_cast<void (*)(NVFBC_API_FUNCTION_LIST*)>(
-        dlsym(m_libNVFBC, "NvFBCCreateInstance"));
-    if (NvFBCCreateInstance_ptr == nullptr) {
-        std::cerr << "Unable to resolve symbol 'NvFBCCreateInstance': " << dlerror() << std::endl;
+bool NVFBCVideoDeviceImpl::BindContext() {
+    if (!m_session) {
         return false;
     }
 
-    m_pFn = new NVFBC_API_FUNCTION_LIST();
-    memset(m_pFn, 0, sizeof(NVFBC_API_FUNCTION_LIST));
-    m_pFn->dwVersion = NVFBC_VERSION;
+    NVFBC_BIND_CONTEXT_PARAMS bindParams;
+    memset(&bindParams, 0, sizeof(bindParams));
+    bindParams.dwVersion = NVFBC_BIND_CONTEXT_PARAMS_VER;
 
-    NVFBCSTATUS fbcStatus = ((PNVFBCCREATEINSTANCE)NvFBCCreateInstance_ptr)(m_pFn);
+    NVFBCSTATUS fbcStatus = m_pFn->nvFBCBindContext(m_session, &bindParams);
     if (fbcStatus != NVFBC_SUCCESS) {
-        std::cerr << "Unable to create NvFBC instance (status: " << fbcStatus << ")" << std::endl;
+        std::cerr << "NVFBC Bind Context failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool NVFBCVideoDeviceImpl::ReleaseContext() {
+    if (!m_session) {
+        return false;
+    }
+
+    NVFBC_RELEASE_CONTEXT_PARAMS releaseParams;
+    memset(&releaseParams, 0, sizeof(releaseParams));
+    releaseParams.dwVersion = NVFBC_RELEASE_CONTEXT_PARAMS_VER;
+
+    NVFBCSTATUS fbcStatus = m_pFn->nvFBCReleaseContext(m_session, &releaseParams);
+    if (fbcStatus != NVFBC_SUCCESS) {
+        std::cerr << "NVFBC Release Context failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool NVFBCVideoDeviceImpl::InitializeNvFBC() {
+    m_pFn = LoadNvFBC();
+    return m_pFn != nullptr;
+}
+
+bool NVFBCVideoDeviceImpl::CreateHandle() {
+    NVFBC_CREATE_HANDLE_PARAMS createHandleParams;
+    memset(&createHandleParams, 0, sizeof(createHandleParams));
+    createHandleParams.dwVersion = NVFBC_CREATE_HANDLE_PARAMS_VER;
+
+    // NvFBC connects to whatever DISPLAY names while creating the handle,
+    // and only then; short of an externally managed GLX context there is no
+    // other way to choose the display. When it is not ours, point DISPLAY
+    // there for the duration and put back the value it had on entry, read
+    // afresh each time so later changes by the application are kept. The
+    // mutex only orders NVFBC devices among themselves: the rest of the
+    // process must not touch the environment meanwhile (see display_id).
+    // Everything after runs on the handle and leaves the environment alone.
+    std::lock_guard<std::mutex> lock(g_displayMutex);
+    const char* current = getenv("DISPLAY");
+    bool inherited = current != nullptr;
+    std::string previous = inherited ? current : "";
+    ResolveDisplayName(current);
+    bool switchDisplay = !inherited || m_displayName != previous;
+    if (switchDisplay) {
+        setenv("DISPLAY", m_displayName.c_str(), 1);
+    }
+
+    NVFBCSTATUS fbcStatus = m_pFn->nvFBCCreateHandle(&m_session, &createHandleParams);
+
+    if (switchDisplay) {
+        if (inherited) {
+            setenv("DISPLAY", previous.c_str(), 1);
+        } else {
+            unsetenv("DISPLAY");
+        }
+    }
+
+    if (fbcStatus != NVFBC_SUCCESS) {
+        std::cerr << "NVFBC Create Handle failed on " << m_displayName << ": "
+                  << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
+        m_session = 0;
         return false;
     }
     return true;
@@ -192,16 +367,10 @@ bool NVFBCVideoDeviceImpl::InitializeNvFBC() {
 
 bool NVFBCVideoDeviceImpl::CreateCaptureSession() {
     NVFBCSTATUS fbcStatus;
-    NVFBC_CREATE_HANDLE_PARAMS createHandleParams;
     NVFBC_CREATE_CAPTURE_SESSION_PARAMS createCaptureParams;
     NVFBC_GET_STATUS_PARAMS statusParams;
 
-    // Create Handle
-    memset(&createHandleParams, 0, sizeof(createHandleParams));
-    createHandleParams.dwVersion = NVFBC_CREATE_HANDLE_PARAMS_VER;
-    fbcStatus = m_pFn->nvFBCCreateHandle(&m_session, &createHandleParams);
-    if (fbcStatus != NVFBC_SUCCESS) {
-        std::cerr << "NVFBC Create Handle failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
+    if (!CreateHandle()) {
         return false;
     }
 
@@ -219,18 +388,29 @@ bool NVFBCVideoDeviceImpl::CreateCaptureSession() {
         return false;
     }
 
+    // The X screen, before any output tracking, cropping or scaling
+    m_width = static_cast<int>(statusParams.screenSize.w);
+    m_height = static_cast<int>(statusParams.screenSize.h);
+
+    m_outputs.clear();
+    for (uint32_t i = 0; i < statusParams.dwOutputNum && i < NVFBC_OUTPUT_MAX; ++i) {
+        NVFBCOutput output;
+        output.id = statusParams.outputs[i].dwId;
+        output.name = statusParams.outputs[i].name;
+        output.tracked_box = statusParams.outputs[i].trackedBox;
+        m_outputs.push_back(output);
+    }
+
     // Create Capture Session
     memset(&createCaptureParams, 0, sizeof(createCaptureParams));
     createCaptureParams.dwVersion = NVFBC_CREATE_CAPTURE_SESSION_PARAMS_VER;
     createCaptureParams.eCaptureType = NVFBC_CAPTURE_TO_SYS;
     createCaptureParams.bWithCursor = m_config.cursor ? NVFBC_TRUE : NVFBC_FALSE;
-    createCaptureParams.captureBox.x = 0;
-    createCaptureParams.captureBox.y = 0;
-    createCaptureParams.captureBox.w = m_width;
-    createCaptureParams.captureBox.h = m_height;
-    createCaptureParams.frameSize.w = m_width;
-    createCaptureParams.frameSize.h = m_height;
-    createCaptureParams.eTrackingType = NVFBC_TRACKING_SCREEN;
+    createCaptureParams.bPushModel = m_config.push_model ? NVFBC_TRUE : NVFBC_FALSE;
+    createCaptureParams.dwSamplingRateMs = static_cast<uint32_t>(std::max(m_config.sampling_rate_ms, 0));
+    if (!SetUpCaptureRegion(statusParams, &createCaptureParams)) {
+        return false;
+    }
 
     fbcStatus = m_pFn->nvFBCCreateCaptureSession(m_session, &createCaptureParams);
     if (fbcStatus != NVFBC_SUCCESS) {
@@ -241,54 +421,238 @@ bool NVFBCVideoDeviceImpl::CreateCaptureSession() {
     return true;
 }
 
-bool NVFBCVideoDeviceImpl::GrabFrame(NVFBC_BUFFER_FORMAT format, std::vector<uint8_t>* data) {
-    if (!data || m_width == 0 || m_height == 0) {
+bool NVFBCVideoDeviceImpl::SetUpCaptureRegion(const NVFBC_GET_STATUS_PARAMS& status,
+                                              NVFBC_CREATE_CAPTURE_SESSION_PARAMS* params) {
+    // Region NvFBC tracks, before cropping
+    uint32_t trackedWidth = static_cast<uint32_t>(m_width);
+    uint32_t trackedHeight = static_cast<uint32_t>(m_height);
+    params->eTrackingType = NVFBC_TRACKING_SCREEN;
+    if (!m_config.output_name.empty()) {
+        if (status.bXRandRAvailable == NVFBC_FALSE) {
+            std::cerr << "Cannot track output " << m_config.output_name << ": XRandR is not available" << std::endl;
+            return false;
+        }
+        auto output = std::find_if(m_outputs.begin(), m_outputs.end(), [this](const NVFBCOutput& o) {
+            return o.name == m_config.output_name;
+        });
+        if (output == m_outputs.end()) {
+            std::cerr << "Unknown output: " << m_config.output_name << " (connected:";
+            for (const NVFBCOutput& o : m_outputs) {
+                std::cerr << " " << o.name;
+            }
+            std::cerr << ")" << std::endl;
+            return false;
+        }
+        params->eTrackingType = NVFBC_TRACKING_OUTPUT;
+        params->dwOutputId = output->id;
+        trackedWidth = output->tracked_box.w;
+        trackedHeight = output->tracked_box.h;
+    }
+
+    // Crop, relative to the tracked region
+    const NVFBC_BOX& box = m_config.capture_box;
+    uint32_t width = trackedWidth;
+    uint32_t height = trackedHeight;
+    if (box.w != 0 || box.h != 0) {
+        if (box.w == 0 || box.h == 0 ||
+            box.x + box.w > trackedWidth || box.y + box.h > trackedHeight) {
+            std::cerr << "Capture box " << box.w << "x" << box.h << "+" << box.x << "+" << box.y
+                      << " is outside the tracked " << trackedWidth << "x" << trackedHeight << " region" << std::endl;
+            return false;
+        }
+        params->captureBox = box;
+        width = box.w;
+        height = box.h;
+    }
+
+    // Scaling happens on the GPU, before the frame is copied to system
+    // memory. Rounding keeps every buffer format valid.
+    if (m_config.frame_size.w != 0 || m_config.frame_size.h != 0) {
+        if (m_config.frame_size.w == 0 || m_config.frame_size.h == 0) {
+            std::cerr << "Invalid frame size " << m_config.frame_size.w << "x" << m_config.frame_size.h << std::endl;
+            return false;
+        }
+        params->frameSize = m_config.frame_size;
+        params->bRoundFrameSize = NVFBC_TRUE;
+        width = (m_config.frame_size.w + 3) & ~3u;
+        height = (m_config.frame_size.h + 1) & ~1u;
+    }
+
+    m_width = static_cast<int>(width);
+    m_height = static_cast<int>(height);
+    return true;
+}
+
+std::vector<NVFBCOutput> NVFBCVideoDeviceImpl::GetOutputs() const {
+    return m_outputs;
+}
+
+const unsigned char* NVFBCVideoDeviceImpl::GrabFrame(NVFBC_BUFFER_FORMAT format) {
+    if (m_config.grab_mode == NVFBCGrabMode::NEW_FRAME) {
+        // Blocks until the display server renders, unless it already has
+        return GrabFrame(format, NVFBC_TOSYS_GRAB_FLAGS_NOWAIT_IF_NEW_FRAME_READY,
+                         static_cast<uint32_t>(std::max(m_config.grab_timeout_ms, 0)),
+                         m_config.skip_unchanged);
+    }
+    return GrabFrame(format, NVFBC_TOSYS_GRAB_FLAGS_NOWAIT, 0, m_config.skip_unchanged);
+}
+
+const unsigned char* NVFBCVideoDeviceImpl::GrabFrame(NVFBC_BUFFER_FORMAT format, uint32_t flags,
+                                                     uint32_t timeoutMs, bool skipUnchanged) {
+    if (m_width == 0 || m_height == 0) {
         std::cerr << "Invalid parameters for frame capture" << std::endl;
-        return false;
+        return nullptr;
     }
 
     NVFBCSTATUS fbcStatus;
-    NVFBC_TOSYS_SETUP_PARAMS setupParams;
     NVFBC_TOSYS_GRAB_FRAME_PARAMS grabParams;
     NVFBC_FRAME_GRAB_INFO frameInfo;
-    unsigned char* frame = nullptr;
-
-    // Setup for the capture
-    memset(&setupParams, 0, sizeof(setupParams));
-    setupParams.dwVersion = NVFBC_TOSYS_SETUP_PARAMS_VER;
-    setupParams.eBufferFormat = format;
-    setupParams.ppBuffer = reinterpret_cast<void**>(&frame);
-    setupParams.bWithDiffMap = NVFBC_FALSE;
 
-    fbcStatus = m_pFn->nvFBCToSysSetUp(m_session, &setupParams);
-    if (fbcStatus != NVFBC_SUCCESS) {
-        std::cerr << "NVFBC ToSysSetUp failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
-        return false;
+    m_lastFrameInfo.skipped = false;
+    m_diffMapValid = false;
+    if (!SetUpToSys(format)) {
+        return nullptr;
     }
 
     // Prepare for frame grab
     memset(&grabParams, 0, sizeof(grabParams));
     memset(&frameInfo, 0, sizeof(frameInfo));
     grabParams.dwVersion = NVFBC_TOSYS_GRAB_FRAME_PARAMS_VER;
-    grabParams.dwFlags = NVFBC_TOSYS_GRAB_FLAGS_NOWAIT; // Non-blocking grab
     grabParams.pFrameGrabInfo = &frameInfo;
+    grabParams.dwFlags = flags;
+    grabParams.dwTimeoutMs = timeoutMs;
 
     // Grab the frame
     fbcStatus = m_pFn->nvFBCToSysGrabFrame(m_session, &grabParams);
     if (fbcStatus != NVFBC_SUCCESS) {
         std::cerr << "NVFBC Grab Frame failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
-        return false;
+        return nullptr;
     }
 
+    const unsigned char* frame = static_cast<const unsigned char*>(m_sysBuffer);
     if (frame == nullptr) {
         std::cerr << "Frame pointer is null" << std::endl;
+        return nullptr;
+    }
+
+    // Copies out assume the size the session was set up for
+    if ((frameInfo.dwWidth != 0 && frameInfo.dwWidth != static_cast<uint32_t>(m_width)) ||
+        (frameInfo.dwHeight != 0 && frameInfo.dwHeight != static_cast<uint32_t>(m_height))) {
+        std::cerr << "NVFBC frame is " << frameInfo.dwWidth << "x" << frameInfo.dwHeight
+                  << ", expected " << m_width << "x" << m_height << std::endl;
+        return nullptr;
+    }
+
+    // NvFBC stamps when the display server started rendering the frame, on
+    // its own time base. The smallest recent offset to our clock is the one
+    // least inflated by grab latency, so map through that. Only the last
+    // kTimestampOffsetWindowUs of grabs count, so the offset follows drift
+    // between the two clocks in either direction; when it rises, timestamps
+    // are held back rather than allowed to go backwards.
+    int64_t now = GetCaptureClockUs();
+    int64_t timestampUs = now;
+    if (frameInfo.ulTimestampUs != 0) {
+        int64_t offset = now - static_cast<int64_t>(frameInfo.ulTimestampUs);
+        while (!m_timestampOffsets.empty() && m_timestampOffsets.back().second >= offset) {
+            m_timestampOffsets.pop_back();
+        }
+        m_timestampOffsets.emplace_back(now, offset);
+        while (m_timestampOffsets.front().first < now - kTimestampOffsetWindowUs) {
+            m_timestampOffsets.pop_front();
+        }
+        timestampUs = static_cast<int64_t>(frameInfo.ulTimestampUs) + m_timestampOffsets.front().second;
+    }
+    m_lastFrameInfo.timestamp_us = std::max(timestampUs, m_lastFrameInfo.timestamp_us);
+    m_lastFrameInfo.is_new_frame = frameInfo.bIsNewFrame == NVFBC_TRUE;
+    m_lastFrameInfo.missed_frames = frameInfo.dwMissedFrames;
+    m_lastFrameInfo.frame_number = frameInfo.dwCurrentFrame;
+
+    // The first grab after setting up has nothing to compare against
+    m_diffMapValid = m_sysWithDiffMap && !m_sysFirstGrab && m_diffMap != nullptr;
+    m_sysFirstGrab = false;
+
+    // Nothing was redrawn, so there is nothing to copy or encode
+    if (skipUnchanged && !m_lastFrameInfo.is_new_frame) {
+        m_lastFrameInfo.skipped = true;
+        return nullptr;
+    }
+
+    return frame;
+}
+
+NVFBCFrameInfo NVFBCVideoDeviceImpl::GetLastFrameInfo() const {
+    return m_lastFrameInfo;
+}
+
+bool NVFBCVideoDeviceImpl::GetDirtyTiles(int tileSize, DirtyTileMap* tiles) const {
+    if (!tiles) {
+        return false;
+    }
+
+    tiles->Reset(m_width, m_height, tileSize);
+    if (!m_diffMapValid) {
+        tiles->MarkAll();
+        return false;
+    }
+
+    // Walk the map at the size NvFBC reported, not one derived from the
+    // frame, so rounding on either side cannot read past its end
+    tiles->MarkBlocks(static_cast<const uint8_t*>(m_diffMap),
+                      static_cast<int>(m_diffMapSize.w), static_cast<int>(m_diffMapSize.h),
+                      m_config.diff_map_block_size);
+    return true;
+}
+
+bool NVFBCVideoDeviceImpl::SetUpToSys(NVFBC_BUFFER_FORMAT format) {
+    // Setting up allocates the buffer, so only do it when the format changes
+    if (m_sysSetUp && m_sysFormat == format) {
+        return true;
+    }
+
+    NVFBC_TOSYS_SETUP_PARAMS setupParams;
+    memset(&setupParams, 0, sizeof(setupParams));
+    setupParams.dwVersion = NVFBC_TOSYS_SETUP_PARAMS_VER;
+    setupParams.eBufferFormat = format;
+    setupParams.ppBuffer = &m_sysBuffer;
+
+    // NvFBC cannot produce diff maps for planar YUV
+    bool withDiffMap = m_config.diff_map_block_size > 0 && format != NVFBC_BUFFER_FORMAT_YUV444P;
+    setupParams.bWithDiffMap = withDiffMap ? NVFBC_TRUE : NVFBC_FALSE;
+    if (withDiffMap) {
+        setupParams.ppDiffMap = &m_diffMap;
+        setupParams.dwDiffMapScalingFactor = static_cast<uint32_t>(m_config.diff_map_block_size);
+    }
+
+    m_sysSetUp = false;
+    NVFBCSTATUS fbcStatus = m_pFn->nvFBCToSysSetUp(m_session, &setupParams);
+    if (fbcStatus != NVFBC_SUCCESS) {
+        std::cerr << "NVFBC ToSysSetUp failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
+        return false;
+    }
+
+    m_sysFormat = format;
+    m_sysSetUp = true;
+    m_sysWithDiffMap = withDiffMap;
+    m_diffMapSize = withDiffMap ? setupParams.diffMapSize : NVFBC_SIZE{0, 0};
+    m_sysFirstGrab = true;
+    return true;
+}
+
+bool NVFBCVideoDeviceImpl::GrabFrame(NVFBC_BUFFER_FORMAT format, std::vector<uint8_t>* data) {
+    if (!data) {
+        std::cerr << "Invalid parameters for frame capture" << std::endl;
+        return false;
+    }
+
+    const unsigned char* frame = GrabFrame(format);
+    if (!frame) {
         return false;
     }
 
     // Calculate frame size and copy data
     size_t frameSize = CalculateFrameSize(format);
     data->resize(frameSize);
-    std::memcpy(data->data(), frame, frameSize);
+    CopyRows(frame, frameSize, data->data(), frameSize, frameSize, 1);
 
     return true;
 }
@@ -330,6 +694,13 @@ void NVFBCVideoDeviceImpl::DestroyCaptureSession() {
             std::cerr << "NVFBC Destroy Capture Session failed: " << m_pFn->nvFBCGetLastErrorStr(m_session) << std::endl;
         }
     }
+    
+    // The buffer went with the session
+    m_sysSetUp = false;
+    m_sysBuffer = nullptr;
+    m_diffMap = nullptr;
+    m_diffMapSize = NVFBC_SIZE{0, 0};
+    m_diffMapValid = false;
 }
 
 void NVFBCVideoDeviceImpl::DestroyHandle() {
@@ -346,15 +717,26 @@ void NVFBCVideoDeviceImpl::DestroyHandle() {
         }
         m_session = 0;
     }
-
-    if (m_pFn) {
-        delete m_pFn;
-        m_pFn = nullptr;
-    }
 }
 
 } // namespace
 
+bool NVFBCVideoDevice::Preload() {
+    return LoadNvFBC() != nullptr;
+}
+
+std::future<std::unique_ptr<NVFBCVideoDevice>> NVFBCVideoDevice::CreateAsync(
+    const NVFBCVideoDeviceConfig& config) {
+    return std::async(std::launch::async, [config]() {
+        std::unique_ptr<NVFBCVideoDevice> device = Create(config);
+        if (device) {
+            // Free the context for whichever thread grabs
+            device->ReleaseContext();
+        }
+        return device;
+    });
+}
+
 std::unique_ptr<NVFBCVideoDevice> NVFBCVideoDevice::Create(const NVFBCVideoDeviceConfig& config) {
     auto device = std::make_unique<NVFBCVideoDeviceImpl>(config);
     
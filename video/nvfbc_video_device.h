@@ -1,20 +1,86 @@
 #ifndef NVFBC_VIDEO_DEVICE_H_
 #define NVFBC_VIDEO_DEVICE_H_
 
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
 #include "nvfbc/nvfbc.h"
+#include "dirty_tile_map.h"
+#include "frame_pool.h"
 
 namespace media {
 
+/**
+ * How a grab waits for the display server to render
+ */
+enum class NVFBCGrabMode {
+    NOWAIT,     // Return the latest frame at once, even if it was returned before
+    NEW_FRAME,  // Return at once if there is an unseen frame, else wait for one
+};
+
+/**
+ * A frame in NvFBC's own system memory buffer, tightly packed
+ */
+struct NVFBCFrameView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;  // Bytes
+    int width = 0;
+    int height = 0;
+};
+
 /**
  * Configuration options for the NVFBC video device
  */
 struct NVFBCVideoDeviceConfig {
     bool cursor = true;           // Include cursor in captures
     std::string display_id = "";  // X11 display identifier (e.g., ":0", ":1")
-                                  // Empty string means default display
+                                  // Empty string means $DISPLAY, or ":0" if unset.
+                                  // NvFBC offers no way to choose the display but
+                                  // DISPLAY (or an externally managed GLX context),
+                                  // so creating a device sets DISPLAY for the
+                                  // duration, one NVFBC device at a time, then puts
+                                  // back the value it had just before. No other
+                                  // thread may call getenv or setenv while a device
+                                  // is being created. Grabs do not touch it.
+    NVFBCGrabMode grab_mode = NVFBCGrabMode::NOWAIT;
+    int grab_timeout_ms = 0;      // Longest NEW_FRAME grabs wait, 0 for no limit
+    bool skip_unchanged = false;  // Fail grabs that return no new frame, without copying
+    bool push_model = false;      // Render a frame on every damage event, not on a timer
+    int sampling_rate_ms = 0;     // Timer period the display server renders new content at,
+                                  // 0 for NvFBC's 16 ms. Ignored with push_model.
+    int diff_map_block_size = 0;  // If set, grabs also produce a change map with one
+                                  // entry per block of this many pixels square
+    std::string output_name = ""; // RandR output to track (e.g., "DP-0"), see GetOutputs
+                                  // Empty string means the whole X screen
+    NVFBC_BOX capture_box = {0, 0, 0, 0};  // Crop of the tracked region, all zero for all of it
+    NVFBC_SIZE frame_size = {0, 0};        // Size the driver scales captures to, zero for
+                                           // none. Rounded up to a multiple of 4 x 2.
+};
+
+/**
+ * An RandR output NvFBC can track
+ */
+struct NVFBCOutput {
+    uint32_t id = 0;
+    std::string name;       // As reported by xrandr(1), e.g., "DVI-I-0"
+    NVFBC_BOX tracked_box;  // Region of the X screen the output shows
+};
+
+/**
+ * What NvFBC reported about the most recent grab
+ */
+struct NVFBCFrameInfo {
+    bool is_new_frame = false;   // False if the display server had not rendered since
+                                 // the previous grab, or a NEW_FRAME wait timed out
+    uint32_t missed_frames = 0;  // Frames rendered since the previous grab but never grabbed
+    uint32_t frame_number = 0;   // NvFBC's frame counter
+    int64_t timestamp_us = 0;    // Render time mapped onto the GetCaptureClockUs time base
+                                 // through the smallest offset of the last 2 s of
+                                 // grabs, so it follows clock drift; never decreases
+    bool skipped = false;        // The grab failed only because nothing new was
+                                 // rendered: skip_unchanged is set, or a
+                                 // WaitForFrame timed out
 };
 
 /**
@@ -30,20 +96,40 @@ public:
      */
     static std::unique_ptr<NVFBCVideoDevice> Create(const NVFBCVideoDeviceConfig& config);
     
+    /**
+     * Starts creating a device on a background thread and returns at once.
+     * The device's context is left unbound; call BindContext on the thread
+     * that grabs before using it.
+     * 
+     * @param config Configuration options for the device
+     * @return Future for the device, which is nullptr if creation failed
+     */
+    static std::future<std::unique_ptr<NVFBCVideoDevice>> CreateAsync(
+        const NVFBCVideoDeviceConfig& config);
+    
+    /**
+     * Loads the NvFBC library and resolves its entry points, once per
+     * process. Create does this on first use; calling it early, e.g. at
+     * startup, takes the cost off the first device. Safe from any thread.
+     * 
+     * @return true if the library is available
+     */
+    static bool Preload();
+    
     /**
      * Destructor
      */
     virtual ~NVFBCVideoDevice() = default;
     
     /**
-     * Get the width of the captured frame
+     * Get the width of the captured frame, after cropping and scaling
      * 
      * @return Width in pixels
      */
     virtual int GetWidth() const = 0;
     
     /**
-     * Get the height of the captured frame
+     * Get the height of the captured frame, after cropping and scaling
      * 
      * @return Height in pixels
      */
@@ -60,6 +146,83 @@ public:
     virtual bool GetFrameNV12(std::vector<uint8_t>* data) = 0;
     
     virtual bool GetFrameYUV444P(std::vector<uint8_t>* data) = 0;
+    
+    /**
+     * Captures a frame into a buffer from the device's frame pool, so a
+     * steady capture loop does not allocate
+     * 
+     * @param format NvFBC buffer format to capture in
+     * @param frame Receives the captured frame
+     * @return true on success
+     */
+    virtual bool GetFrame(NVFBC_BUFFER_FORMAT format, FrameRef* frame) = 0;
+    
+    /**
+     * Blocks until the display server renders a frame this device has not
+     * captured yet, then captures it as GetFrame does. Returns at once if
+     * one is already waiting. Pair with push_model or sampling_rate_ms to
+     * have the driver pace a capture thread.
+     * 
+     * @param format NvFBC buffer format to capture in
+     * @param timeoutMs Longest wait, 0 for no limit
+     * @param frame Receives the captured frame
+     * @return true if a new frame was captured; false on error, or on
+     *         timeout with GetLastFrameInfo().skipped set
+     */
+    virtual bool WaitForFrame(NVFBC_BUFFER_FORMAT format, int timeoutMs, FrameRef* frame) = 0;
+    
+    /**
+     * Captures a frame and lends out NvFBC's buffer instead of copying it.
+     * The view is valid until the next capture call of any kind, or until
+     * the device is destroyed.
+     * 
+     * @param format NvFBC buffer format to capture in
+     * @param view Receives the frame
+     * @return true on success
+     */
+    virtual bool BorrowFrame(NVFBC_BUFFER_FORMAT format, NVFBCFrameView* view) = 0;
+    
+    /**
+     * Gets what NvFBC reported about the most recent grab
+     * 
+     * @return Information on the last grab, zeroed before the first one
+     */
+    virtual NVFBCFrameInfo GetLastFrameInfo() const = 0;
+    
+    /**
+     * Marks the tiles that changed in the most recent grab, from NvFBC's
+     * diff map. Every tile is marked when that grab has no usable diff map:
+     * diff_map_block_size is unset, it was the first grab in its format, or
+     * the format was YUV444P, which NvFBC cannot produce diff maps for.
+     * 
+     * @param tileSize Tile width and height in pixels
+     * @param tiles Receives the map, sized for the frame
+     * @return true if the map came from NvFBC's diff map
+     */
+    virtual bool GetDirtyTiles(int tileSize, DirtyTileMap* tiles) const = 0;
+    
+    /**
+     * Gets the RandR outputs NvFBC reported when the session was created
+     * 
+     * @return Connected outputs, empty if XRandR is not available
+     */
+    virtual std::vector<NVFBCOutput> GetOutputs() const = 0;
+    
+    /**
+     * Makes the session's context current on the calling thread. The
+     * context starts out bound to the thread that created the device and
+     * must be released there before another thread can bind it.
+     * 
+     * @return true on success
+     */
+    virtual bool BindContext() = 0;
+    
+    /**
+     * Detaches the session's context from the calling thread
+     * 
+     * @return true on success
+     */
+    virtual bool ReleaseContext() = 0;
 };
 
 } // namespace media
@@ -0,0 +1,149 @@
+#include "pixel_kernels.h"
+
+#include <cstring>
+#include "cpu_features.h"
+
+#ifdef MEDIA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace media {
+
+namespace {
+
+// Below this a single core copies faster than threads can be woken
+constexpr size_t kParallelCopyThreshold = 1024 * 1024;
+
+//
+// Scalar kernels
+//
+
+void SwizzleRB_C(const uint8_t* src, uint8_t* dst, size_t pixels) {
+  for (size_t i = 0; i < pixels; ++i) {
+    uint8_t c0 = src[i * 4 + 0];
+    uint8_t c2 = src[i * 4 + 2];
+    dst[i * 4 + 0] = c2;
+    dst[i * 4 + 1] = src[i * 4 + 1];
+    dst[i * 4 + 2] = c0;
+    dst[i * 4 + 3] = src[i * 4 + 3];
+  }
+}
+
+#ifdef MEDIA_X86_KERNELS
+
+//
+// R/B swaps with byte shuffles
+//
+
+__attribute__((target("ssse3")))
+void SwizzleRB_SSSE3(const uint8_t* src, uint8_t* dst, size_t pixels) {
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                        10, 9, 8, 11, 14, 13, 12, 15);
+  size_t i = 0;
+  for (; i + 4 <= pixels; i += 4) {
+    __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4),
+                     _mm_shuffle_epi8(px, shuffle));
+  }
+  SwizzleRB_C(src + i * 4, dst + i * 4, pixels - i);
+}
+
+__attribute__((target("avx2")))
+void SwizzleRB_AVX2(const uint8_t* src, uint8_t* dst, size_t pixels) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+      2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  size_t i = 0;
+  for (; i + 8 <= pixels; i += 8) {
+    __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4),
+                        _mm256_shuffle_epi8(px, shuffle));
+  }
+  SwizzleRB_C(src + i * 4, dst + i * 4, pixels - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void SwizzleRB_AVX512(const uint8_t* src, uint8_t* dst, size_t pixels) {
+  const __m512i shuffle = _mm512_broadcast_i32x4(
+      _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15));
+  size_t i = 0;
+  for (; i + 16 <= pixels; i += 16) {
+    __m512i px = _mm512_loadu_si512(src + i * 4);
+    _mm512_storeu_si512(dst + i * 4, _mm512_shuffle_epi8(px, shuffle));
+  }
+  SwizzleRB_C(src + i * 4, dst + i * 4, pixels - i);
+}
+
+#endif  // MEDIA_X86_KERNELS
+
+typedef void (*SwizzleFunc)(const uint8_t*, uint8_t*, size_t);
+
+struct PixelKernels {
+  SwizzleFunc swizzle_rb;
+};
+
+PixelKernels SelectKernels(CpuLevel level) {
+  PixelKernels kernels = {SwizzleRB_C};
+#ifdef MEDIA_X86_KERNELS
+  if (level >= CpuLevel::SSSE3) {
+    kernels.swizzle_rb = SwizzleRB_SSSE3;
+  }
+  if (level >= CpuLevel::AVX2) {
+    kernels.swizzle_rb = SwizzleRB_AVX2;
+  }
+  if (level >= CpuLevel::AVX512) {
+    kernels.swizzle_rb = SwizzleRB_AVX512;
+  }
+#else
+  (void)level;
+#endif
+  return kernels;
+}
+
+const PixelKernels& GetKernels() {
+  static const PixelKernels kernels = SelectKernels(GetCpuLevel());
+  return kernels;
+}
+
+// Copies a band of rows, as a single run when both buffers are packed
+void CopyBand(const uint8_t* src, size_t src_stride,
+              uint8_t* dst, size_t dst_stride,
+              size_t row_bytes, int rows) {
+  if (src_stride == row_bytes && dst_stride == row_bytes) {
+    row_bytes *= rows;
+    rows = 1;
+  }
+  
+  for (int row = 0; row < rows; ++row) {
+    const uint8_t* src_row = src + row * src_stride;
+    uint8_t* dst_row = dst + row * dst_stride;
+    std::memcpy(dst_row, src_row, row_bytes);
+  }
+}
+
+}  // namespace
+
+void CopyRows(const uint8_t* src, size_t src_stride,
+              uint8_t* dst, size_t dst_stride,
+              size_t row_bytes, int rows,
+              WorkerPool* pool) {
+  if (rows <= 0 || row_bytes == 0) {
+    return;
+  }
+  
+  if (pool && row_bytes * rows >= kParallelCopyThreshold) {
+    pool->ForEachBand(rows, 1, [&](int first_row, int end_row) {
+      CopyBand(src + first_row * src_stride, src_stride,
+               dst + first_row * dst_stride, dst_stride,
+               row_bytes, end_row - first_row);
+    });
+  } else {
+    CopyBand(src, src_stride, dst, dst_stride, row_bytes, rows);
+  }
+}
+
+void SwizzleRB(const uint8_t* src, uint8_t* dst, size_t pixels) {
+  GetKernels().swizzle_rb(src, dst, pixels);
+}
+
+}  // namespace media
@@ -0,0 +1,23 @@
+#ifndef MEDIA_PIXEL_KERNELS_H_
+#define MEDIA_PIXEL_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "worker_pool.h"
+
+namespace media {
+
+// Copies rows between buffers with different strides. With a pool, large
+// copies are split into row bands copied in parallel.
+void CopyRows(const uint8_t* src, size_t src_stride,
+              uint8_t* dst, size_t dst_stride,
+              size_t row_bytes, int rows,
+              WorkerPool* pool = nullptr);
+
+// Swaps the first and third byte of each 32-bit pixel (RGBA <-> BGRA).
+// src and dst may be the same buffer.
+void SwizzleRB(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+}  // namespace media
+
+#endif  // MEDIA_PIXEL_KERNELS_H_
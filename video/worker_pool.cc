@@ -0,0 +1,111 @@
+#include "worker_pool.h"
+
+namespace media {
+
+namespace {
+
+// Bands smaller than this cost more to hand off than to process inline
+constexpr int kMinBandRows = 16;
+
+}  // namespace
+
+WorkerPool::WorkerPool(int threads) {
+  if (threads <= 0) {
+    threads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  for (int i = 1; i < threads; ++i) {
+    workers_.emplace_back(&WorkerPool::WorkerLoop, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkerPool::Run(int rows, int alignment, BandFunc func, const void* context) {
+  if (rows <= 0) {
+    return;
+  }
+  if (alignment < 1) {
+    alignment = 1;
+  }
+  
+  // Round bands up to the alignment so chroma row pairs are never split
+  int threads = GetThreadCount();
+  int band_rows = (rows + threads - 1) / threads;
+  if (band_rows < kMinBandRows) {
+    band_rows = kMinBandRows;
+  }
+  band_rows = (band_rows + alignment - 1) / alignment * alignment;
+  int band_count = (rows + band_rows - 1) / band_rows;
+  
+  if (band_count <= 1 || workers_.empty()) {
+    func(context, 0, rows);
+    return;
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    func_ = func;
+    context_ = context;
+    rows_ = rows;
+    band_rows_ = band_rows;
+    band_count_ = band_count;
+    next_band_ = 0;
+    bands_left_ = band_count;
+    ++generation_;
+  }
+  work_ready_.notify_all();
+  
+  // Help out instead of sleeping, then wait for the stragglers
+  RunBands();
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_done_.wait(lock, [this] { return bands_left_ == 0; });
+  func_ = nullptr;
+  context_ = nullptr;
+}
+
+void WorkerPool::RunBands() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (next_band_ < band_count_) {
+    int band = next_band_++;
+    BandFunc func = func_;
+    const void* context = context_;
+    int first_row = band * band_rows_;
+    int end_row = first_row + band_rows_ < rows_ ? first_row + band_rows_ : rows_;
+    
+    lock.unlock();
+    func(context, first_row, end_row);
+    lock.lock();
+    
+    if (--bands_left_ == 0) {
+      work_done_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::WorkerLoop() {
+  unsigned seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_ready_.wait(lock, [this, seen_generation] {
+        return stopping_ || generation_ != seen_generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+    RunBands();
+  }
+}
+
+}  // namespace media
@@ -0,0 +1,66 @@
+#ifndef MEDIA_WORKER_POOL_H_
+#define MEDIA_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace media {
+
+// Fixed set of threads that split the work on a frame into row bands.
+// The calling thread processes one band itself, so a pool of N threads runs
+// N-1 helpers. Only one ForEachBand call may run at a time.
+class WorkerPool {
+ public:
+  // threads is the total parallelism including the caller; 0 uses one
+  // thread per hardware core
+  explicit WorkerPool(int threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  int GetThreadCount() const { return static_cast<int>(workers_.size()) + 1; }
+
+  // Splits [0, rows) into contiguous bands whose starts are multiples of
+  // alignment, calls fn(first_row, end_row) for each band in parallel and
+  // returns once all of them have finished. Small inputs run inline.
+  template <typename Fn>
+  void ForEachBand(int rows, int alignment, const Fn& fn) {
+    Run(rows, alignment, &InvokeBand<Fn>, &fn);
+  }
+
+ private:
+  typedef void (*BandFunc)(const void* context, int first_row, int end_row);
+
+  template <typename Fn>
+  static void InvokeBand(const void* context, int first_row, int end_row) {
+    (*static_cast<const Fn*>(context))(first_row, end_row);
+  }
+
+  void Run(int rows, int alignment, BandFunc func, const void* context);
+  void RunBands();
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+  bool stopping_ = false;
+  unsigned generation_ = 0;  // Bumped for every job so workers wake once
+
+  // Current job, guarded by mutex_
+  BandFunc func_ = nullptr;
+  const void* context_ = nullptr;
+  int rows_ = 0;
+  int band_rows_ = 0;
+  int band_count_ = 0;
+  int next_band_ = 0;
+  int bands_left_ = 0;
+};
+
+}  // namespace media
+
+#endif  // MEDIA_WORKER_POOL_H_
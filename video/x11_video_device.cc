@@ -4,13 +4,79 @@
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 #include <xcb/shm.h>
+#include <xcb/damage.h>
 #include <sys/shm.h>
 #include <sys/ipc.h>
+#include <poll.h>
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
+#include "capture_clock.h"
+#include "pixel_kernels.h"
 
 namespace media {
 
+namespace {
+// Above this many pending rectangles damage is collapsed to its bounding box
+constexpr size_t kMaxDamageRects = 64;
+
+X11Rect BoundingBox(const X11Rect& a, const X11Rect& b) {
+  int x0 = std::min(a.x, b.x);
+  int y0 = std::min(a.y, b.y);
+  int x1 = std::max(a.x + a.width, b.x + b.width);
+  int y1 = std::max(a.y + a.height, b.y + b.height);
+  return X11Rect{x0, y0, x1 - x0, y1 - y0};
+}
+
+bool Touches(const X11Rect& a, const X11Rect& b) {
+  return a.x <= b.x + b.width && b.x <= a.x + a.width &&
+         a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+// Clip rectangles to the screen and merge the ones that overlap or touch,
+// so each pixel is fetched from the X server at most once per frame
+std::vector<X11Rect> MergeRects(const std::vector<X11Rect>& input,
+                                int width, int height) {
+  std::vector<X11Rect> rects;
+  rects.reserve(input.size());
+  for (const X11Rect& rect : input) {
+    int x0 = std::max(rect.x, 0);
+    int y0 = std::max(rect.y, 0);
+    int x1 = std::min(rect.x + rect.width, width);
+    int y1 = std::min(rect.y + rect.height, height);
+    if (x1 > x0 && y1 > y0) {
+      rects.push_back(X11Rect{x0, y0, x1 - x0, y1 - y0});
+    }
+  }
+  
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (size_t i = 0; i < rects.size() && !merged; ++i) {
+      for (size_t j = i + 1; j < rects.size(); ++j) {
+        if (Touches(rects[i], rects[j])) {
+          rects[i] = BoundingBox(rects[i], rects[j]);
+          rects.erase(rects.begin() + j);
+          merged = true;
+          break;
+        }
+      }
+    }
+  }
+  
+  // When most of the screen changed a single full request is cheaper
+  int64_t area = 0;
+  for (const X11Rect& rect : rects) {
+    area += static_cast<int64_t>(rect.width) * rect.height;
+  }
+  if (area * 4 > static_cast<int64_t>(width) * height * 3) {
+    rects.assign(1, X11Rect{0, 0, width, height});
+  }
+  return rects;
+}
+}  // namespace
+
 std::unique_ptr<X11VideoDevice> X11VideoDevice::Create(const X11VideoDeviceConfig& config) {
   std::unique_ptr<X11VideoDevice> device(new X11VideoDevice(config));
   if (!device->Initialize()) {
@@ -24,6 +90,15 @@ X11VideoDevice::X11VideoDevice(const X11VideoDeviceConfig& config)
 }
 
 X11VideoDevice::~X11VideoDevice() {
+  // Release the last non-SHM frame
+  if (standard_reply_) {
+    free(standard_reply_);
+    standard_reply_ = nullptr;
+  }
+  
+  // Stop damage tracking
+  CleanupDamage();
+  
   // Clean up shared memory resources
   CleanupShm();
   
@@ -93,32 +168,117 @@ bool X11VideoDevice::Initialize() {
     }
   }
   
+  // Split copies and conversions of large frames across threads
+  if (config_.worker_threads != 1) {
+    worker_pool_.reset(new WorkerPool(config_.worker_threads));
+  }
+  
+  // Track damaged regions if requested
+  if (config_.use_damage) {
+    has_damage_ = InitializeDamage();
+    if (!has_damage_) {
+      std::cerr << "XDamage extension not available, capturing full frames" << std::endl;
+    }
+  }
+  
   return true;
 }
 
+bool X11VideoDevice::InitializeDamage() {
+  // Query for DAMAGE extension
+  const xcb_query_extension_reply_t* ext_reply =
+      xcb_get_extension_data(connection_, &xcb_damage_id);
+  if (!ext_reply || !ext_reply->present) {
+    return false;
+  }
+  damage_event_base_ = ext_reply->first_event;
+  
+  // The version must be negotiated before any other damage request
+  xcb_damage_query_version_cookie_t ver_cookie =
+      xcb_damage_query_version(connection_, 1, 1);
+  xcb_damage_query_version_reply_t* ver_reply =
+      xcb_damage_query_version_reply(connection_, ver_cookie, nullptr);
+  if (!ver_reply) {
+    return false;
+  }
+  free(ver_reply);
+  
+  // Report every damaged rectangle of the root window
+  damage_ = xcb_generate_id(connection_);
+  xcb_void_cookie_t create_cookie = xcb_damage_create_checked(
+      connection_, damage_, root_window_, XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+  
+  xcb_generic_error_t* error = xcb_request_check(connection_, create_cookie);
+  if (error) {
+    std::cerr << "Failed to create damage object: error code "
+              << static_cast<int>(error->error_code) << std::endl;
+    free(error);
+    damage_ = 0;
+    return false;
+  }
+  
+  damage_frame_.resize(static_cast<size_t>(width_) * height_ * 4);
+  damage_frame_valid_ = false;
+  return true;
+}
+
+void X11VideoDevice::CleanupDamage() {
+  if (has_damage_) {
+    if (connection_ && damage_) {
+      xcb_damage_destroy(connection_, damage_);
+      damage_ = 0;
+    }
+    
+    damage_rects_.clear();
+    damage_frame_.clear();
+    damage_frame_valid_ = false;
+    has_damage_ = false;
+  }
+}
+
 bool X11VideoDevice::InitializeShm() {
   // Calculate the size needed for the image (BGRA - 4 bytes per pixel)
   shm_size_ = width_ * height_ * 4;
   
+  // Allocate the ring of segments, one request can be in flight per segment
+  int segment_count = std::max(config_.shm_segments, 1);
+  for (int i = 0; i < segment_count; ++i) {
+    ShmSegment segment;
+    if (!AttachShmSegment(&segment)) {
+      for (ShmSegment& attached : shm_segments_) {
+        xcb_shm_detach(connection_, attached.seg);
+        shmdt(attached.addr);
+      }
+      shm_segments_.clear();
+      return false;
+    }
+    shm_segments_.push_back(segment);
+  }
+  
+  shm_seg_ = shm_segments_[0].seg;
+  shm_addr_ = shm_segments_[0].addr;
+  return true;
+}
+
+bool X11VideoDevice::AttachShmSegment(ShmSegment* segment) {
   // Create a shared memory segment
-  shm_id_ = shmget(IPC_PRIVATE, shm_size_, IPC_CREAT | 0777);
-  if (shm_id_ == -1) {
+  int shm_id = shmget(IPC_PRIVATE, shm_size_, IPC_CREAT | 0777);
+  if (shm_id == -1) {
     std::cerr << "Failed to create shared memory segment: " << strerror(errno) << std::endl;
     return false;
   }
   
   // Attach the segment to our process
-  shm_addr_ = shmat(shm_id_, nullptr, 0);
-  if (shm_addr_ == reinterpret_cast<void*>(-1)) {
+  void* shm_addr = shmat(shm_id, nullptr, 0);
+  if (shm_addr == reinterpret_cast<void*>(-1)) {
     std::cerr << "Failed to attach shared memory: " << strerror(errno) << std::endl;
-    shmctl(shm_id_, IPC_RMID, nullptr);
-    shm_id_ = -1;
+    shmctl(shm_id, IPC_RMID, nullptr);
     return false;
   }
   
   // Attach the segment to X server
-  shm_seg_ = xcb_generate_id(connection_);
-  xcb_void_cookie_t attach_cookie = xcb_shm_attach_checked(connection_, shm_seg_, shm_id_, false);
+  xcb_shm_seg_t shm_seg = xcb_generate_id(connection_);
+  xcb_void_cookie_t attach_cookie = xcb_shm_attach_checked(connection_, shm_seg, shm_id, false);
   
   xcb_generic_error_t* error = xcb_request_check(connection_, attach_cookie);
   
@@ -126,30 +286,40 @@ bool X11VideoDevice::InitializeShm() {
     std::cerr << "Failed to attach shared memory to X server: error code " 
               << error->error_code << std::endl;
     free(error);
-    shmdt(shm_addr_);
-    shmctl(shm_id_, IPC_RMID, nullptr);
-    shm_addr_ = nullptr;
-    shm_id_ = -1;
+    shmdt(shm_addr);
+    shmctl(shm_id, IPC_RMID, nullptr);
     return false;
   }
   
   // Mark the segment for deletion after detach
-  shmctl(shm_id_, IPC_RMID, nullptr);
+  shmctl(shm_id, IPC_RMID, nullptr);
   
+  segment->seg = shm_seg;
+  segment->id = shm_id;
+  segment->addr = shm_addr;
   return true;
 }
 
 void X11VideoDevice::CleanupShm() {
   if (has_shm_) {
-    if (connection_ && shm_seg_) {
-      xcb_shm_detach(connection_, shm_seg_);
-      shm_seg_ = 0;
+    // The reply of an in-flight request is no longer wanted
+    if (connection_ && shm_pending_) {
+      xcb_discard_reply(connection_, shm_pending_cookie_.sequence);
+      shm_pending_ = false;
     }
     
-    if (shm_addr_ != nullptr) {
-      shmdt(shm_addr_);
-      shm_addr_ = nullptr;
+    for (ShmSegment& segment : shm_segments_) {
+      if (connection_ && segment.seg) {
+        xcb_shm_detach(connection_, segment.seg);
+      }
+      
+      if (segment.addr != nullptr) {
+        shmdt(segment.addr);
+      }
     }
+    shm_segments_.clear();
+    shm_seg_ = 0;
+    shm_addr_ = nullptr;
     
     has_shm_ = false;
   }
@@ -164,20 +334,54 @@ int X11VideoDevice::GetHeight() const {
 }
 
 bool X11VideoDevice::GetFrameBGRA(uint8_t* bgra_data) {
-  if (!connection_ || !screen_ || !bgra_data) {
+  return GetFrameBGRA(bgra_data, width_ * 4);
+}
+
+bool X11VideoDevice::GetFrameBGRA(uint8_t* bgra_data, int stride) {
+  if (!connection_ || !screen_ || !bgra_data || stride < width_ * 4) {
+    return false;
+  }
+  
+  const uint8_t* frame = CaptureFrame();
+  if (!frame) {
     return false;
   }
   
+  // Copy data to the output buffer in BGRA format
+  size_t row_bytes = static_cast<size_t>(width_) * 4;
+  CopyRows(frame, row_bytes, bgra_data, stride, row_bytes, height_, worker_pool_.get());
+  return true;
+}
+
+const uint8_t* X11VideoDevice::CaptureFrame() {
+  // Only fetch what changed, then hand out the persistent frame
+  if (has_damage_) {
+    if (!UpdateDamagedRegions(nullptr)) {
+      return nullptr;
+    }
+    return damage_frame_.data();
+  }
+  
   // Use shared memory if available, otherwise fall back to standard method
   if (has_shm_ && shm_addr_) {
-    return GetFrameShm(bgra_data);
-  } else {
-    return GetFrameStandard(bgra_data);
+    size_t ready_index = 0;
+    if (!CaptureShm(&ready_index)) {
+      return nullptr;
+    }
+    return static_cast<const uint8_t*>(shm_segments_[ready_index].addr);
   }
+  return CaptureStandard();
 }
 
-bool X11VideoDevice::GetFrameStandard(uint8_t* bgra_data) {
+const uint8_t* X11VideoDevice::CaptureStandard() {
+  // The previous frame is no longer referenced
+  if (standard_reply_) {
+    free(standard_reply_);
+    standard_reply_ = nullptr;
+  }
+  
   // Get the image from the root window (full screen)
+  capture_time_us_ = GetCaptureClockUs();
   xcb_get_image_cookie_t cookie = xcb_get_image(
       connection_,
       XCB_IMAGE_FORMAT_Z_PIXMAP,
@@ -193,42 +397,76 @@ bool X11VideoDevice::GetFrameStandard(uint8_t* bgra_data) {
   if (error) {
     std::cerr << "Failed to get image: error code " << error->error_code << std::endl;
     free(error);
-    return false;
+    return nullptr;
   }
   
   if (!reply) {
     std::cerr << "Failed to get image: null reply" << std::endl;
-    return false;
+    return nullptr;
   }
   
-  // Get the image data
-  uint8_t* src_data = xcb_get_image_data(reply);
-  uint32_t src_data_len = xcb_get_image_data_length(reply);
-  
-  // Copy data to the output buffer in BGRA format
   // Note: Depending on the X server's pixel format, you might need a more complex conversion here
-  std::memcpy(bgra_data, src_data, src_data_len);
+  if (static_cast<size_t>(xcb_get_image_data_length(reply)) <
+      static_cast<size_t>(width_) * height_ * 4) {
+    std::cerr << "Failed to get image: unexpected image size" << std::endl;
+    free(reply);
+    return nullptr;
+  }
   
-  free(reply);
-  return true;
+  // Keep the reply alive so its data can be consumed in place
+  standard_reply_ = reply;
+  return xcb_get_image_data(reply);
 }
 
-bool X11VideoDevice::GetFrameShm(uint8_t* bgra_data) {
-  // Get the image using shared memory
-  xcb_shm_get_image_cookie_t cookie = xcb_shm_get_image(
+void X11VideoDevice::RequestShmFrame(size_t index) {
+  // Ask for the full root window into the given segment
+  shm_pending_cookie_ = xcb_shm_get_image(
       connection_,
       root_window_,
       0, 0,               // x, y
       width_, height_,    // width, height
       ~0,                 // plane mask (all planes)
       XCB_IMAGE_FORMAT_Z_PIXMAP,  // format
-      shm_seg_,           // shared memory segment
+      shm_segments_[index].seg,   // shared memory segment
       0                   // offset within segment
   );
+  shm_pending_index_ = index;
+  shm_pending_time_us_ = GetCaptureClockUs();
+  shm_pending_ = true;
+  
+  // Make sure the request leaves now rather than with the next reply wait
+  xcb_flush(connection_);
+}
+
+bool X11VideoDevice::FindFreeSegment(size_t start, size_t exclude, size_t* index) const {
+  for (size_t i = 0; i < shm_segments_.size(); ++i) {
+    size_t candidate = (start + i) % shm_segments_.size();
+    if (candidate != exclude && !shm_segments_[candidate].leased) {
+      *index = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool X11VideoDevice::CaptureShm(size_t* ready_index) {
+  // Nothing in flight yet (first frame, single segment or after an error)
+  if (!shm_pending_) {
+    size_t index = 0;
+    if (!FindFreeSegment(shm_pending_index_, shm_segments_.size(), &index)) {
+      std::cerr << "All shared memory segments are leased" << std::endl;
+      return false;
+    }
+    RequestShmFrame(index);
+  }
+  
+  *ready_index = shm_pending_index_;
+  capture_time_us_ = shm_pending_time_us_;
+  shm_pending_ = false;
   
   xcb_generic_error_t* error = nullptr;
   xcb_shm_get_image_reply_t* reply = 
-      xcb_shm_get_image_reply(connection_, cookie, &error);
+      xcb_shm_get_image_reply(connection_, shm_pending_cookie_, &error);
   
   if (error) {
     std::cerr << "Failed to get image with SHM: error code " 
@@ -242,11 +480,370 @@ bool X11VideoDevice::GetFrameShm(uint8_t* bgra_data) {
     return false;
   }
   
-  // Copy data from shared memory to the output buffer
-  std::memcpy(bgra_data, shm_addr_, shm_size_);
-  
   free(reply);
+  
+  // With a ring, the next frame is captured into another segment while
+  // this one is consumed; leased segments are never written to
+  size_t next_index = 0;
+  if (FindFreeSegment(*ready_index + 1, *ready_index, &next_index)) {
+    RequestShmFrame(next_index);
+  }
+  return true;
+}
+
+bool X11VideoDevice::AcquireFrame(X11FrameLease* lease) {
+  if (!connection_ || !screen_ || !lease) {
+    return false;
+  }
+  
+  // Only frames living in shared memory can be handed out without a copy
+  if (!has_shm_ || has_damage_) {
+    return false;
+  }
+  
+  size_t ready_index = 0;
+  if (!CaptureShm(&ready_index)) {
+    return false;
+  }
+  
+  shm_segments_[ready_index].leased = true;
+  lease->data = static_cast<const uint8_t*>(shm_segments_[ready_index].addr);
+  lease->width = width_;
+  lease->height = height_;
+  lease->stride = width_ * 4;
+  lease->index = static_cast<int>(ready_index);
+  return true;
+}
+
+void X11VideoDevice::ReleaseFrame(const X11FrameLease& lease) {
+  if (lease.index < 0 || static_cast<size_t>(lease.index) >= shm_segments_.size()) {
+    return;
+  }
+  shm_segments_[lease.index].leased = false;
+}
+
+bool X11VideoDevice::GetFrameBGRA(FrameRef* frame) {
+  if (!frame) {
+    return false;
+  }
+  
+  FrameRef buffer = frame_pool_.Acquire(static_cast<size_t>(width_) * height_ * 4);
+  if (!buffer || !GetFrameBGRA(buffer->data(), width_ * 4)) {
+    return false;
+  }
+  *frame = std::move(buffer);
+  return true;
+}
+
+bool X11VideoDevice::GetFrameNV12(std::vector<uint8_t>* data) {
+  if (!data) {
+    return false;
+  }
+  
+  data->resize(YUV420FrameSize(width_, height_));
+  return GetPackedNV12(data->data());
+}
+
+bool X11VideoDevice::GetFrameNV12(FrameRef* frame) {
+  if (!frame) {
+    return false;
+  }
+  
+  FrameRef buffer = frame_pool_.Acquire(YUV420FrameSize(width_, height_));
+  if (!buffer || !GetPackedNV12(buffer->data())) {
+    return false;
+  }
+  *frame = std::move(buffer);
+  return true;
+}
+
+bool X11VideoDevice::GetFrameNV12(uint8_t* y, int y_stride, uint8_t* uv, int uv_stride) {
+  if (!connection_ || !screen_ || !y || !uv ||
+      y_stride < width_ || uv_stride < ((width_ + 1) / 2) * 2) {
+    return false;
+  }
+  
+  // Convert straight out of the capture buffer, no intermediate BGRA copy
+  const uint8_t* frame = CaptureFrame();
+  if (!frame) {
+    return false;
+  }
+  
+  ConvertBGRAToNV12(frame, width_ * 4, width_, height_, y, y_stride, uv, uv_stride,
+                    config_.color_matrix, config_.color_range, worker_pool_.get());
+  return true;
+}
+
+bool X11VideoDevice::GetFrameYUV420(std::vector<uint8_t>* data) {
+  if (!data) {
+    return false;
+  }
+  
+  data->resize(YUV420FrameSize(width_, height_));
+  return GetPackedI420(data->data());
+}
+
+bool X11VideoDevice::GetFrameYUV420(FrameRef* frame) {
+  if (!frame) {
+    return false;
+  }
+  
+  FrameRef buffer = frame_pool_.Acquire(YUV420FrameSize(width_, height_));
+  if (!buffer || !GetPackedI420(buffer->data())) {
+    return false;
+  }
+  *frame = std::move(buffer);
+  return true;
+}
+
+bool X11VideoDevice::GetFrameYUV420(uint8_t* y, int y_stride,
+                                    uint8_t* u, int u_stride,
+                                    uint8_t* v, int v_stride) {
+  int chroma_width = (width_ + 1) / 2;
+  if (!connection_ || !screen_ || !y || !u || !v ||
+      y_stride < width_ || u_stride < chroma_width || v_stride < chroma_width) {
+    return false;
+  }
+  
+  // Convert straight out of the capture buffer, no intermediate BGRA copy
+  const uint8_t* frame = CaptureFrame();
+  if (!frame) {
+    return false;
+  }
+  
+  ConvertBGRAToI420(frame, width_ * 4, width_, height_,
+                    y, y_stride, u, u_stride, v, v_stride,
+                    config_.color_matrix, config_.color_range, worker_pool_.get());
+  return true;
+}
+
+bool X11VideoDevice::GetPackedNV12(uint8_t* out) {
+  uint8_t* uv = out + static_cast<size_t>(width_) * height_;
+  return GetFrameNV12(out, width_, uv, ((width_ + 1) / 2) * 2);
+}
+
+bool X11VideoDevice::GetPackedI420(uint8_t* out) {
+  int chroma_width = (width_ + 1) / 2;
+  int chroma_height = (height_ + 1) / 2;
+  uint8_t* u = out + static_cast<size_t>(width_) * height_;
+  uint8_t* v = u + static_cast<size_t>(chroma_width) * chroma_height;
+  return GetFrameYUV420(out, width_, u, chroma_width, v, chroma_width);
+}
+
+bool X11VideoDevice::GetDirtyFrameBGRA(uint8_t* bgra_data,
+                                       std::vector<X11Rect>* dirty_rects) {
+  if (!connection_ || !screen_ || !bgra_data || !dirty_rects) {
+    return false;
+  }
+  
+  // Without damage tracking every frame is entirely dirty
+  if (!has_damage_) {
+    if (!GetFrameBGRA(bgra_data)) {
+      return false;
+    }
+    dirty_rects->assign(1, X11Rect{0, 0, width_, height_});
+    return true;
+  }
+  
+  if (!UpdateDamagedRegions(dirty_rects)) {
+    return false;
+  }
+  
+  // Copy only the regions that changed into the caller's frame
+  const size_t stride = static_cast<size_t>(width_) * 4;
+  for (const X11Rect& rect : *dirty_rects) {
+    size_t offset = rect.y * stride + static_cast<size_t>(rect.x) * 4;
+    CopyRows(damage_frame_.data() + offset, stride,
+             bgra_data + offset, stride,
+             static_cast<size_t>(rect.width) * 4, rect.height, worker_pool_.get());
+  }
   return true;
 }
 
+void X11VideoDevice::CollectDamage() {
+  xcb_generic_event_t* event = nullptr;
+  while ((event = xcb_poll_for_event(connection_)) != nullptr) {
+    if ((event->response_type & 0x7f) == damage_event_base_ + XCB_DAMAGE_NOTIFY) {
+      const xcb_damage_notify_event_t* notify =
+          reinterpret_cast<const xcb_damage_notify_event_t*>(event);
+      damage_rects_.push_back(X11Rect{notify->area.x, notify->area.y,
+                                      notify->area.width, notify->area.height});
+      
+      // Keep the pending list bounded while the screen is very busy
+      if (damage_rects_.size() > kMaxDamageRects) {
+        X11Rect bounds = damage_rects_.front();
+        for (const X11Rect& rect : damage_rects_) {
+          bounds = BoundingBox(bounds, rect);
+        }
+        damage_rects_.assign(1, bounds);
+      }
+    }
+    free(event);
+  }
+  
+  // Reset the server-side region, the events already told us what changed
+  xcb_damage_subtract(connection_, damage_, XCB_NONE, XCB_NONE);
+}
+
+bool X11VideoDevice::WaitForDamage(int timeout_ms) {
+  if (!connection_ || !has_damage_) {
+    return false;
+  }
+  
+  // The first frame is always pending
+  CollectDamage();
+  if (!damage_frame_valid_ || !damage_rects_.empty()) {
+    return true;
+  }
+  
+  // Sleep on the connection until damage arrives. Other events wake us
+  // too, so keep waiting out the rest of the timeout after them.
+  xcb_flush(connection_);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(std::max(timeout_ms, 0));
+  while (damage_rects_.empty()) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return false;
+    }
+    pollfd fd = {xcb_get_file_descriptor(connection_), POLLIN, 0};
+    int ready = poll(&fd, 1, static_cast<int>(remaining.count()));
+    if (ready < 0 && errno != EINTR) {
+      return false;
+    }
+    if (xcb_connection_has_error(connection_)) {
+      return false;
+    }
+    CollectDamage();
+  }
+  return true;
+}
+
+bool X11VideoDevice::UpdateDamagedRegions(std::vector<X11Rect>* dirty_rects) {
+  capture_time_us_ = GetCaptureClockUs();
+  CollectDamage();
+  
+  // The first frame, or one after a failed capture, is fetched entirely
+  std::vector<X11Rect> rects;
+  if (!damage_frame_valid_) {
+    rects.push_back(X11Rect{0, 0, width_, height_});
+  } else {
+    rects = MergeRects(damage_rects_, width_, height_);
+  }
+  damage_rects_.clear();
+  
+  if (!rects.empty() && !CaptureRegions(rects)) {
+    damage_frame_valid_ = false;
+    return false;
+  }
+  damage_frame_valid_ = true;
+  
+  if (dirty_rects) {
+    dirty_rects->swap(rects);
+  }
+  return true;
+}
+
+bool X11VideoDevice::CaptureRegions(const std::vector<X11Rect>& rects) {
+  const size_t frame_stride = static_cast<size_t>(width_) * 4;
+  
+  if (!has_shm_ || !shm_addr_) {
+    // Issue every request up front so the round trips overlap
+    std::vector<xcb_get_image_cookie_t> cookies;
+    cookies.reserve(rects.size());
+    for (const X11Rect& rect : rects) {
+      cookies.push_back(xcb_get_image(connection_, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                      root_window_, rect.x, rect.y,
+                                      rect.width, rect.height, ~0));
+    }
+    
+    bool success = true;
+    for (size_t i = 0; i < rects.size(); ++i) {
+      xcb_generic_error_t* error = nullptr;
+      xcb_get_image_reply_t* reply =
+          xcb_get_image_reply(connection_, cookies[i], &error);
+      if (error) {
+        std::cerr << "Failed to get damaged region: error code "
+                  << static_cast<int>(error->error_code) << std::endl;
+        free(error);
+        success = false;
+        continue;
+      }
+      if (!reply) {
+        success = false;
+        continue;
+      }
+      
+      const X11Rect& rect = rects[i];
+      size_t row_bytes = static_cast<size_t>(rect.width) * 4;
+      CopyRows(xcb_get_image_data(reply), row_bytes,
+               damage_frame_.data() + rect.y * frame_stride + rect.x * 4,
+               frame_stride, row_bytes, rect.height);
+      free(reply);
+    }
+    return success;
+  }
+  
+  // Pack as many regions as fit into the segment, then scatter them into
+  // the persistent frame once the server has written them
+  std::vector<xcb_shm_get_image_cookie_t> cookies;
+  std::vector<size_t> offsets;
+  cookies.reserve(rects.size());
+  offsets.reserve(rects.size());
+  
+  bool success = true;
+  size_t first = 0;
+  size_t offset = 0;
+  for (size_t i = 0; i <= rects.size(); ++i) {
+    size_t size = 0;
+    if (i < rects.size()) {
+      size = static_cast<size_t>(rects[i].width) * rects[i].height * 4;
+    }
+    
+    // Flush the pending batch when the segment is full or at the end
+    if (i == rects.size() || offset + size > shm_size_) {
+      for (size_t j = first; j < i; ++j) {
+        xcb_generic_error_t* error = nullptr;
+        xcb_shm_get_image_reply_t* reply =
+            xcb_shm_get_image_reply(connection_, cookies[j - first], &error);
+        if (error) {
+          std::cerr << "Failed to get damaged region with SHM: error code "
+                    << static_cast<int>(error->error_code) << std::endl;
+          free(error);
+          success = false;
+          continue;
+        }
+        if (!reply) {
+          success = false;
+          continue;
+        }
+        free(reply);
+        
+        const X11Rect& rect = rects[j];
+        size_t row_bytes = static_cast<size_t>(rect.width) * 4;
+        CopyRows(static_cast<const uint8_t*>(shm_addr_) + offsets[j - first],
+                 row_bytes,
+                 damage_frame_.data() + rect.y * frame_stride + rect.x * 4,
+                 frame_stride, row_bytes, rect.height);
+      }
+      cookies.clear();
+      offsets.clear();
+      first = i;
+      offset = 0;
+    }
+    
+    if (i < rects.size()) {
+      const X11Rect& rect = rects[i];
+      cookies.push_back(xcb_shm_get_image(
+          connection_, root_window_,
+          rect.x, rect.y, rect.width, rect.height,
+          ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, shm_seg_, offset));
+      offsets.push_back(offset);
+      offset += size;
+    }
+  }
+  return success;
+}
+
 }  // namespace media
\ No newline at end of file
@@ -3,10 +3,15 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 #include <xcb/shm.h>
+#include <xcb/damage.h>
 #include <sys/shm.h>
+#include "color_convert.h"
+#include "frame_pool.h"
+#include "worker_pool.h"
 
 namespace media {
 
@@ -14,6 +19,28 @@ struct X11VideoDeviceConfig {
   bool cursor = false;
   std::string display_id = ":0";
   bool use_shm = true;  // Option to use shared memory (default: true)
+  bool use_damage = false;  // Only re-capture regions reported by XDamage
+  int shm_segments = 1;  // More than one pipelines the next capture request
+  ColorMatrix color_matrix = ColorMatrix::BT601;  // Used for YUV output
+  ColorRange color_range = ColorRange::LIMITED;   // Used for YUV output
+  int worker_threads = 1;  // Threads for copy and conversion, 0 for one per core
+};
+
+// Region of the root window, in pixels
+struct X11Rect {
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Read-only view of a captured frame that stays in shared memory
+struct X11FrameLease {
+  const uint8_t* data = nullptr;
+  int width = 0;
+  int height = 0;
+  int stride = 0;  // Bytes per row
+  int index = -1;  // Segment holding the frame
 };
 
 class X11VideoDevice {
@@ -34,6 +61,57 @@ class X11VideoDevice {
   // Returns true if successful, false otherwise
   bool GetFrameBGRA(uint8_t* bgra_data);
 
+  // Captures a frame and converts it to NV12 (Y plane, interleaved UV plane)
+  // Returns true if successful, false otherwise
+  bool GetFrameNV12(std::vector<uint8_t>* data);
+  
+  // Captures a frame and converts it to I420 (Y, U and V planes)
+  // Returns true if successful, false otherwise
+  bool GetFrameYUV420(std::vector<uint8_t>* data);
+  
+  // Same as above, but the frame is written to a buffer from the device's
+  // frame pool, so a steady capture loop does not allocate
+  bool GetFrameBGRA(FrameRef* frame);
+  bool GetFrameNV12(FrameRef* frame);
+  bool GetFrameYUV420(FrameRef* frame);
+  
+  // Same as above, but the frame is written to caller planes whose row
+  // strides (in bytes) may be padded, e.g. encoder input surfaces
+  bool GetFrameBGRA(uint8_t* bgra_data, int stride);
+  bool GetFrameNV12(uint8_t* y, int y_stride, uint8_t* uv, int uv_stride);
+  bool GetFrameYUV420(uint8_t* y, int y_stride,
+                      uint8_t* u, int u_stride,
+                      uint8_t* v, int v_stride);
+  
+  // Captures a frame in BGRA format and reports the regions that changed
+  // since the previous call. Only the dirty regions are written, so the same
+  // buffer must be passed on every call. Without XDamage the whole frame is
+  // reported dirty.
+  // Returns true if successful, false otherwise
+  bool GetDirtyFrameBGRA(uint8_t* bgra_data, std::vector<X11Rect>* dirty_rects);
+  
+  // Captures a frame in BGRA format and leases the shared memory segment it
+  // was written to instead of copying it. The segment is not reused until
+  // ReleaseFrame is called, so use one segment per outstanding lease plus
+  // two to keep captures pipelined. Requires SHM without damage tracking.
+  // Returns true if successful, false otherwise
+  bool AcquireFrame(X11FrameLease* lease);
+  
+  // Returns a leased segment to the ring
+  void ReleaseFrame(const X11FrameLease& lease);
+  
+  // Blocks for up to timeout_ms until XDamage reports a change the next
+  // capture has not fetched yet. Returns false on timeout, or at once
+  // without damage tracking (see HasDamage).
+  bool WaitForDamage(int timeout_ms);
+  
+  // True if damage tracking is active
+  bool HasDamage() const { return has_damage_; }
+  
+  // Capture time of the last frame returned, taken when the X server was
+  // asked for the image, in GetCaptureClockUs microseconds
+  int64_t GetCaptureTimeUs() const { return capture_time_us_; }
+
  private:
   // Private constructor - only accessible via Create factory method
   X11VideoDevice(const X11VideoDeviceConfig& config);
@@ -41,17 +119,57 @@ class X11VideoDevice {
   // Initializes the XCB connection and screen
   bool Initialize();
   
-  // Initialize shared memory segment
+  // Capture into a tightly packed 4:2:0 buffer
+  bool GetPackedNV12(uint8_t* out);
+  bool GetPackedI420(uint8_t* out);
+  
+  // One shared memory segment attached to both us and the X server
+  struct ShmSegment {
+    xcb_shm_seg_t seg = 0;
+    int id = -1;
+    void* addr = nullptr;
+    bool leased = false;  // Handed out by AcquireFrame
+  };
+  
+  // Initialize the ring of shared memory segments
   bool InitializeShm();
   
+  // Create one shared memory segment and attach it to the X server
+  bool AttachShmSegment(ShmSegment* segment);
+  
   // Clean up shared memory resources
   void CleanupShm();
   
+  // Capture a frame and return its BGRA pixels in place (SHM segment,
+  // persistent damage frame or image reply). Valid until the next capture.
+  const uint8_t* CaptureFrame();
+  
   // Get frame using regular (non-SHM) method
-  bool GetFrameStandard(uint8_t* bgra_data);
+  const uint8_t* CaptureStandard();
+  
+  // Issue a full-frame capture request into a ring segment without waiting
+  void RequestShmFrame(size_t index);
+  
+  // Wait for the pending frame and pipeline the next request
+  bool CaptureShm(size_t* ready_index);
+  
+  // Find a segment that is not leased, searching from start and skipping exclude
+  bool FindFreeSegment(size_t start, size_t exclude, size_t* index) const;
+  
+  // Subscribe to damage reports on the root window
+  bool InitializeDamage();
+  
+  // Clean up damage resources
+  void CleanupDamage();
   
-  // Get frame using shared memory method
-  bool GetFrameShm(uint8_t* bgra_data);
+  // Drain pending damage events into damage_rects_
+  void CollectDamage();
+  
+  // Re-capture damaged regions into damage_frame_ and return them merged
+  bool UpdateDamagedRegions(std::vector<X11Rect>* dirty_rects);
+  
+  // Capture a list of regions into damage_frame_
+  bool CaptureRegions(const std::vector<X11Rect>& rects);
   
   // Member variables
   X11VideoDeviceConfig config_;
@@ -64,11 +182,36 @@ class X11VideoDevice {
   
   // Shared memory related members
   bool has_shm_ = false;
-  xcb_shm_seg_t shm_seg_ = 0;
-  int shm_id_ = -1;
+  std::vector<ShmSegment> shm_segments_;
+  xcb_shm_seg_t shm_seg_ = 0;  // First segment, also used for damaged regions
   void* shm_addr_ = nullptr;
   size_t shm_size_ = 0;
   
+  // Request in flight for the pipelined ring
+  bool shm_pending_ = false;
+  size_t shm_pending_index_ = 0;
+  xcb_shm_get_image_cookie_t shm_pending_cookie_ = {};
+  int64_t shm_pending_time_us_ = 0;  // When the request was sent
+  
+  // Damage related members
+  bool has_damage_ = false;
+  xcb_damage_damage_t damage_ = 0;
+  uint8_t damage_event_base_ = 0;
+  std::vector<X11Rect> damage_rects_;
+  std::vector<uint8_t> damage_frame_;  // Persistent copy of the screen
+  bool damage_frame_valid_ = false;
+  
+  // Reply holding the last frame captured without SHM
+  xcb_get_image_reply_t* standard_reply_ = nullptr;
+  
+  int64_t capture_time_us_ = 0;  // See GetCaptureTimeUs
+  
+  // Splits copy and conversion into row bands, null when single threaded
+  std::unique_ptr<WorkerPool> worker_pool_;
+  
+  // Buffers handed out by the FrameRef overloads
+  FramePool frame_pool_;
+  
   // Prevent copy and assignment
   X11VideoDevice(const X11VideoDevice&) = delete;
   X11VideoDevice& operator=(const X11VideoDevice&) = delete;